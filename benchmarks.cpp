@@ -0,0 +1,339 @@
+/*
+Compile and run these benchmarks in bash with:
+g++ -std=c++11 -O2 benchmarks.cpp -o benchmarks && ./benchmarks
+
+Or build every target with CMake:
+cmake -S . -B build && cmake --build build && ./build/rw_gjk_benchmarks
+
+Each benchmark prints the average time per query in nanoseconds. The separating axis test versus
+GJK/EPA comparison is what SAT_MAX_CORNERS in rw_gjk.cpp is tuned with: it should be the highest
+corner count at which the separating axis test is still faster. Tune it in the Release build that
+CMake makes, since -O2 and -O3 don't rank the two the same.
+
+In a traced build (cmake -DRW_GJK_TRACE=ON), each step of the World benchmarks is written to
+benchmarks_trace.json as it finishes. The other benchmarks' spans are thrown away as they go, since
+there would be far too many of them.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+#include "rw_gjk.cpp"
+
+using namespace rw_gjk;
+
+const int SHAPE_PAIR_COUNT = 256;
+const int REPETITIONS = 200;
+
+FILE *trace_file = nullptr;
+
+double randf() {
+	return (rand() % 1000000000) / 1000000000.0;
+}
+
+void make_regular_polygon(int corner_count, Shape *shape_out) {
+	vector<v2> corners;
+	for (int c = 0; c < corner_count; c++) {
+		corners.push_back(v2(0.5, 0).rotated(c * 2*M_PI / corner_count));
+	}
+	bool success = try_make_polygon(corners, shape_out);
+	assert(success);
+}
+
+// Places each pair close enough that roughly half of them overlap.
+void randomise_poses(vector<Shape> &shapes) {
+	for (auto &shape : shapes) {
+		shape.pos = v2(randf() * 1.5, randf() * 1.5);
+		shape.angle = randf() * 2*M_PI;
+	}
+}
+
+void print_benchmark_name(string name) {
+	while (name.size() < 60) {
+		name.push_back('_');
+	}
+	printf("%s", name.c_str());
+	fflush(stdout);
+}
+
+// Runs the query over every pair of shapes and prints the average time it took per query.
+template <typename Query>
+void run_benchmark(vector<Shape> &shapes, Query query) {
+	volatile double sink = 0; // stops the queries from being optimised away.
+	
+	auto start_time = chrono::steady_clock::now();
+	for (int r = 0; r < REPETITIONS; r++) {
+		for (int s = 0; s < shapes.size(); s += 2) {
+			sink = sink + query(&shapes[s], &shapes[s+1]);
+		}
+	}
+	auto end_time = chrono::steady_clock::now();
+	
+	double nanoseconds = chrono::duration<double, nano>(end_time - start_time).count();
+	printf("%8.1f ns\n", nanoseconds / (REPETITIONS * shapes.size() / 2));
+	fflush(stdout);
+	clear_trace();
+}
+
+// Prints the average time it took to get the sin and cos of each angle.
+template <typename Sin_cos>
+void run_trig_benchmark(const vector<double> &angles, string name, Sin_cos sin_cos) {
+	volatile double sink = 0; // stops the trig from being optimised away.
+	double total = 0;
+	print_benchmark_name(name);
+	
+	auto start_time = chrono::steady_clock::now();
+	for (int r = 0; r < REPETITIONS; r++) {
+		for (double angle : angles) {
+			double s, c;
+			sin_cos(angle, &s, &c);
+			total += s + c;
+		}
+	}
+	auto end_time = chrono::steady_clock::now();
+	sink = total;
+	
+	double nanoseconds = chrono::duration<double, nano>(end_time - start_time).count();
+	printf("%8.1f ns\n", nanoseconds / (REPETITIONS * angles.size()));
+	fflush(stdout);
+}
+
+int main() {
+	printf("\n * Running benchmarks for rw_gjk *\n");
+	srand(1);
+	
+	#ifdef RW_GJK_TRACE
+		trace_file = fopen("benchmarks_trace.json", "w");
+	#endif
+	
+	auto overlapping_query = [](Shape *a, Shape *b) {
+		return shapes_are_overlapping(a, b) ? 1.0 : 0.0;
+	};
+	auto overlap_amount_query = [](Shape *a, Shape *b) {
+		return get_overlap_amount(a, b).x;
+	};
+	auto sat_query = [](Shape *a, Shape *b) {
+		return get_sat_overlap_amount(a, b).x;
+	};
+	auto epa_query = [](Shape *a, Shape *b) {
+		return get_epa_overlap_amount(a, b).x;
+	};
+	
+	for (int corner_count = 3; corner_count <= SAT_CORNER_CAPACITY; corner_count++) {
+		printf("\n%i-cornered polygons:\n", corner_count);
+		
+		vector<Shape> shapes(SHAPE_PAIR_COUNT * 2);
+		for (auto &shape : shapes) make_regular_polygon(corner_count, &shape);
+		randomise_poses(shapes);
+		
+		print_benchmark_name("shapes_are_overlapping()");
+		run_benchmark(shapes, overlapping_query);
+		
+		print_benchmark_name("get_overlap_amount(), separating axis test");
+		run_benchmark(shapes, sat_query);
+		
+		print_benchmark_name("get_overlap_amount(), GJK and EPA");
+		run_benchmark(shapes, epa_query);
+	}
+	
+	{
+		printf("\nBoxes:\n");
+		
+		vector<Shape> boxes(SHAPE_PAIR_COUNT * 2);
+		vector<Shape> polygons(SHAPE_PAIR_COUNT * 2);
+		for (int s = 0; s < boxes.size(); s++) {
+			try_make_box(0.8, 0.5, &boxes[s]);
+			try_make_polygon({ v2(-0.4, -0.25), v2(0.4, -0.25), v2(0.4, 0.25), v2(-0.4, 0.25) }, &polygons[s]);
+		}
+		randomise_poses(boxes);
+		for (int s = 0; s < boxes.size(); s++) {
+			polygons[s].pos = boxes[s].pos;
+			polygons[s].angle = boxes[s].angle;
+		}
+		
+		print_benchmark_name("shapes_are_overlapping(), boxes");
+		run_benchmark(boxes, overlapping_query);
+		print_benchmark_name("shapes_are_overlapping(), 4-cornered polygons");
+		run_benchmark(polygons, overlapping_query);
+		print_benchmark_name("get_overlap_amount(), boxes");
+		run_benchmark(boxes, overlap_amount_query);
+		print_benchmark_name("get_overlap_amount(), 4-cornered polygons");
+		run_benchmark(polygons, overlap_amount_query);
+	}
+	
+	{
+		printf("\nRounded shapes:\n");
+		
+		vector<Shape> shapes(SHAPE_PAIR_COUNT * 2);
+		for (int s = 0; s < shapes.size(); s++) {
+			if (s % 2) make_circle(0.3, &shapes[s]);
+			else try_make_capsule(v2(0, -0.3), v2(0, 0.3), 0.2, &shapes[s]);
+		}
+		randomise_poses(shapes);
+		
+		print_benchmark_name("shapes_are_overlapping(), capsules and circles");
+		run_benchmark(shapes, overlapping_query);
+		print_benchmark_name("get_overlap_amount(), capsules and circles");
+		run_benchmark(shapes, overlap_amount_query);
+	}
+	
+	{
+		printf("\nTrig for a shape's rotation:\n");
+		
+		vector<double> angles(SHAPE_PAIR_COUNT * 2);
+		for (auto &angle : angles) angle = (randf() - 0.5) * 20;
+		
+		run_trig_benchmark(angles, "libm sin() and cos()", [](double angle, double *s, double *c) {
+			*s = sin(angle);
+			*c = cos(angle);
+		});
+		run_trig_benchmark(angles, "bundled_sin_cos()", [](double angle, double *s, double *c) {
+			bundled_sin_cos(angle, s, c);
+		});
+	}
+	
+	{
+		printf("\nWorld of 4000 shapes, 5%% of them moving:\n");
+		
+		// the other 95% are either static, or dynamic shapes that keep still and so fall asleep.
+		auto run_world_benchmark = [](string name, bool still_shapes_are_static) {
+			World world;
+			vector<Shape_handle> moving_handles;
+			for (int s = 0; s < 4000; s++) {
+				Shape shape;
+				make_regular_polygon(3 + s % 6, &shape);
+				shape.pos = v2(randf() * 120, randf() * 120);
+				shape.angle = randf() * 2*M_PI;
+				if (s % 20 == 0) moving_handles.push_back(world.add_shape(shape));
+				else world.add_shape(shape, still_shapes_are_static);
+			}
+			for (int step = 0; step <= world.steps_until_sleep; step++) world.step();
+			clear_trace();
+			
+			const int STEP_COUNT = 100;
+			print_benchmark_name(name);
+			auto start_time = chrono::steady_clock::now();
+			for (int step = 0; step < STEP_COUNT; step++) {
+				for (auto handle : moving_handles) {
+					Shape *shape = world.get_shape(handle);
+					shape->pos = shape->pos + v2(randf() - 0.5, randf() - 0.5) * 0.1;
+					shape->angle += 0.05;
+				}
+				world.step();
+				if (trace_file) write_trace(trace_file);
+			}
+			auto end_time = chrono::steady_clock::now();
+			printf("%8.1f us\n", chrono::duration<double, micro>(end_time - start_time).count() / STEP_COUNT);
+			fflush(stdout);
+		};
+		
+		run_world_benchmark("World::step(), the rest static", true);
+		run_world_benchmark("World::step(), the rest dynamic but still", false);
+	}
+	
+	{
+		printf("\nCrowd of 5000 agents walking towards the centre:\n");
+		
+		auto run_solver_benchmark = [](string name, Solver_method method, int thread_count) {
+			World world;
+			vector<Shape_handle> handles;
+			for (int s = 0; s < 5000; s++) {
+				Shape agent;
+				make_circle(0.3, &agent);
+				agent.pos = v2(randf() - 0.5, randf() - 0.5) * 60;
+				handles.push_back(world.add_shape(agent));
+			}
+			Solver_settings settings;
+			settings.method = method;
+			settings.thread_count = thread_count;
+			
+			const int STEP_COUNT = 50;
+			int iteration_count = 0;
+			print_benchmark_name(name);
+			auto start_time = chrono::steady_clock::now();
+			for (int step = 0; step < STEP_COUNT; step++) {
+				for (auto handle : handles) {
+					Shape *agent = world.get_shape(handle);
+					agent->pos = agent->pos - agent->pos.normalised_or_0() * 0.05;
+				}
+				world.step();
+				iteration_count += world.resolve_overlaps(settings).iterations;
+				clear_trace();
+			}
+			auto end_time = chrono::steady_clock::now();
+			printf("%8.1f us, %.1f iterations\n", chrono::duration<double, micro>(end_time - start_time).count() / STEP_COUNT,
+				double(iteration_count) / STEP_COUNT);
+			fflush(stdout);
+		};
+		
+		int thread_count = max(1u, thread::hardware_concurrency());
+		run_solver_benchmark("step() and resolve_overlaps(), Gauss-Seidel", SOLVER_GAUSS_SEIDEL, 1);
+		run_solver_benchmark("step() and resolve_overlaps(), Jacobi, 1 thread", SOLVER_JACOBI, 1);
+		run_solver_benchmark("step() and resolve_overlaps(), Jacobi, one thread per core (" + to_string(thread_count) + ")", SOLVER_JACOBI, thread_count);
+	}
+	
+	{
+		printf("\nConstruction of 8-cornered polygons:\n");
+		
+		/*
+		Every way of making a polygon validates it once, and that validation is most of the cost, so on
+		one thread they all take about as long per polygon. make_polygons() saves the per-shape
+		allocations, and can split the work across threads.
+		*/
+		
+		const int POLYGON_COUNT = 20000;
+		vector<v2> vertices;
+		vector<int> offsets = { 0 };
+		for (int p = 0; p < POLYGON_COUNT; p++) {
+			for (int c = 0; c < 8; c++) vertices.push_back(v2(0.5, 0).rotated(c * 2*M_PI / 8) + v2(randf(), randf()) * 0.01);
+			offsets.push_back(vertices.size());
+		}
+		vector<Shape> shapes(POLYGON_COUNT);
+		vector<Polygon_error> errors(POLYGON_COUNT);
+		
+		auto time_construction = [&](string name, function<void()> construct) {
+			print_benchmark_name(name);
+			auto start_time = chrono::steady_clock::now();
+			construct();
+			auto end_time = chrono::steady_clock::now();
+			printf("%8.1f ns\n", chrono::duration<double, nano>(end_time - start_time).count() / POLYGON_COUNT);
+			fflush(stdout);
+			clear_trace();
+		};
+		
+		time_construction("try_make_polygon(), copying from the buffer", [&]() {
+			for (int p = 0; p < POLYGON_COUNT; p++) {
+				try_make_polygon(&vertices[offsets[p]], offsets[p+1] - offsets[p], &shapes[p]);
+			}
+		});
+		
+		// the vectors are made beforehand, as if the corners had been read straight into them.
+		vector<vector<v2>> corner_vectors(POLYGON_COUNT);
+		for (int p = 0; p < POLYGON_COUNT; p++) {
+			corner_vectors[p].reserve((offsets[p+1] - offsets[p]) * 2);
+			corner_vectors[p].assign(&vertices[offsets[p]], &vertices[offsets[p+1]]);
+		}
+		time_construction("try_make_polygon(), moving vectors in", [&]() {
+			for (int p = 0; p < POLYGON_COUNT; p++) {
+				try_make_polygon(move(corner_vectors[p]), &shapes[p]);
+			}
+		});
+		time_construction("make_polygons(), 1 thread", [&]() {
+			make_polygons(vertices.data(), offsets.data(), POLYGON_COUNT, shapes.data(), errors.data(), 1);
+		});
+		int thread_count = max(1u, thread::hardware_concurrency());
+		time_construction("make_polygons(), one thread per core (" + to_string(thread_count) + ")", [&]() {
+			make_polygons(vertices.data(), offsets.data(), POLYGON_COUNT, shapes.data(), errors.data(), thread_count);
+		});
+	}
+	
+	if (trace_file) {
+		finish_trace();
+		fclose(trace_file);
+	}
+	printf("\n");
+	return 0;
+}
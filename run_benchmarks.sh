@@ -0,0 +1 @@
+clear && echo Compiling... && g++ -std=c++11 -O2 benchmarks.cpp -o benchmarks && ./benchmarks
\ No newline at end of file
@@ -17,48 +17,349 @@ set based on a combination of the size of the shapes being tested and IEEE float
 See end of file for license.
 */
 
-// TODO: calculate LINE_THICKNESS appropriately. It should be very small but never small enough to cause IEEE-float-related problems.
 // TODO: get_minkowski_diffed_corner() can return in-line corners. Investigate.
 
+/*
+Define RW_GJK_STATS before including rw_gjk.cpp to count what each thread's queries are doing. The
+counters can be read with get_stats() and cleared with reset_stats(), e.g. once per frame. Without
+RW_GJK_STATS the counting compiles to nothing and get_stats() always returns zeroes.
+*/
+#ifdef RW_GJK_STATS
+	#define RW_GJK_COUNT(counter) (rw_gjk::thread_stats.counter++)
+	#define RW_GJK_COUNT_ALLOCATION_IF_FULL(vector_) \
+		(rw_gjk::thread_stats.allocations += (vector_).size() == (vector_).capacity())
+#else
+	#define RW_GJK_COUNT(counter) ((void)0)
+	#define RW_GJK_COUNT_ALLOCATION_IF_FULL(vector_) ((void)0)
+#endif
+
+/*
+Define RW_GJK_TRACE before including rw_gjk.cpp to time the broadphase, GJK, EPA, the separating axis
+tests and batch jobs. Each thread keeps its spans until write_trace() writes them out as Chrome trace
+JSON, which chrome://tracing and Perfetto can open. RW_GJK_TRACE_SPAN("frame") can be used in your own
+code to group a frame's spans together. Without RW_GJK_TRACE the spans compile to nothing.
+*/
+#ifdef RW_GJK_TRACE
+	#define RW_GJK_TRACE_SPAN(name) rw_gjk::Trace_span rw_gjk_trace_span(name)
+#else
+	#define RW_GJK_TRACE_SPAN(name) ((void)0)
+#endif
+
+/*
+Define RW_GJK_DETERMINISTIC before including rw_gjk.cpp for results that are the same to the bit on
+every compiler and platform, e.g. for lockstep multiplayer. It swaps libm's trig for
+bundled_sin_cos() and sorts corners without atan2(), which leaves only operations that IEEE 754
+defines exactly. The compiler mustn't undo that, so build without -ffast-math, with
+-ffp-contract=off (GCC and Clang may otherwise fuse a*b + c into one differently-rounded
+instruction), with -fno-tree-slp-vectorize on GCC (whose vectoriser fuses some anyway when the
+target has FMA, e.g. with -march=native) and with SSE2 rather than x87 maths on 32-bit x86.
+*/
+#ifdef RW_GJK_DETERMINISTIC
+	#ifdef __FAST_MATH__
+		#error "RW_GJK_DETERMINISTIC can't be deterministic with -ffast-math."
+	#endif
+	#if defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ != 0
+		#error "RW_GJK_DETERMINISTIC needs doubles to be evaluated as doubles (e.g. -msse2 -mfpmath=sse)."
+	#endif
+#endif
+
 #include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
 #include <cmath>
+#include <cfloat>
+#include <climits>
 #include <cassert>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define RW_GJK_HAS_MMAP
+#endif
 
 namespace rw_gjk {
 	#include "vectors.cpp"
 	
 	using namespace std;
 	
-	const double LINE_THICKNESS = 0.0000001;
 	v2 ORIGIN = v2(0, 0);
 	
+	/*
+	The most iterations that GJK and EPA may each take in one query. When a query hits one of these, it
+	gives up and returns the best answer it has found so far. Lower these to bound the latency of each
+	query. They are shared by all threads, so set them before starting any queries.
+	*/
+	int max_gjk_iterations = 256;
+	int max_epa_iterations = 256;
+	
+	// How a query came up with its answer.
+	enum Status {
+		STATUS_CONVERGED,
+		STATUS_HIT_ITERATION_CAP, // the answer is a best guess.
+		STATUS_DEGENERATE, // the shapes are only just touching, so the answer is a nudge apart.
+	};
+	
+	struct Stats {
+		long gjk_iterations;
+		long epa_iterations;
+		long support_calls; // one per corner of the minkowski difference, i.e. per corner of each shape pair.
+		long degenerate_cases; // origin on a simplex line, unfinished simplices passed to EPA, etc.
+		long allocations; // heap allocations made by temporary vectors.
+		long exact_fallbacks; // side tests too close to call with plain doubles, so they were done exactly.
+	};
+	
+	#ifdef RW_GJK_STATS
+		thread_local Stats thread_stats = {};
+	#endif
+	
+	// Returns the counters for the calling thread's queries since the last reset_stats().
+	Stats get_stats() {
+		#ifdef RW_GJK_STATS
+			return thread_stats;
+		#else
+			return Stats{};
+		#endif
+	}
+	
+	void reset_stats() {
+		#ifdef RW_GJK_STATS
+			thread_stats = Stats{};
+		#endif
+	}
+	
+	#ifdef RW_GJK_TRACE
+		struct Trace_event {
+			const char *name;
+			chrono::steady_clock::time_point start, end;
+		};
+		
+		mutex trace_mutex;
+		const chrono::steady_clock::time_point trace_epoch = chrono::steady_clock::now();
+		int next_trace_thread_id = 1;
+		
+		// Spans from threads that have exited, tagged with their thread ids.
+		vector<pair<int, Trace_event>> orphaned_trace_events;
+		
+		// Each thread's own spans, so that recording one doesn't need a lock.
+		struct Trace_buffer;
+		vector<Trace_buffer *> trace_buffers;
+		
+		struct Trace_buffer {
+			int thread_id;
+			vector<Trace_event> events;
+			
+			Trace_buffer() {
+				lock_guard<mutex> lock(trace_mutex);
+				thread_id = next_trace_thread_id++;
+				trace_buffers.push_back(this);
+			}
+			
+			~Trace_buffer() {
+				lock_guard<mutex> lock(trace_mutex);
+				for (auto &event : events) orphaned_trace_events.push_back({ thread_id, event });
+				trace_buffers.erase(find(trace_buffers.begin(), trace_buffers.end(), this));
+			}
+		};
+		
+		thread_local Trace_buffer thread_trace_buffer;
+		
+		// Records the time from its construction to its destruction. Use it through RW_GJK_TRACE_SPAN.
+		class Trace_span {
+		public:
+			explicit Trace_span(const char *name) : name(name), start(chrono::steady_clock::now()) {}
+			
+			~Trace_span() {
+				thread_trace_buffer.events.push_back({ name, start, chrono::steady_clock::now() });
+			}
+			
+			Trace_span(const Trace_span &) = delete;
+			Trace_span &operator=(const Trace_span &) = delete;
+			
+		private:
+			const char *name;
+			chrono::steady_clock::time_point start;
+		};
+	#endif
+	
+	// Whether write_trace() has opened the array in the current capture. Pipes have no position to tell by.
+	bool trace_array_is_open = false;
+	
+	/*
+	Appends every span recorded so far to the file, in Chrome's JSON array trace format, and forgets them.
+	The first call opens the array, and it's left open, which the format allows, so a capture can be
+	written a frame at a time, even down a pipe. Call it while no queries are running, e.g. between
+	frames, and call finish_trace() before starting on another file.
+	*/
+	void write_trace(FILE *file) {
+		if (!trace_array_is_open) {
+			fprintf(file, "[\n");
+			trace_array_is_open = true;
+		}
+		
+		#ifdef RW_GJK_TRACE
+			auto write_event = [&](int thread_id, const Trace_event &event) {
+				fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f},\n",
+					event.name, thread_id,
+					chrono::duration<double, micro>(event.start - trace_epoch).count(),
+					chrono::duration<double, micro>(event.end - event.start).count());
+			};
+			
+			lock_guard<mutex> lock(trace_mutex);
+			for (auto &event : orphaned_trace_events) write_event(event.first, event.second);
+			orphaned_trace_events.clear();
+			for (auto buffer : trace_buffers) {
+				for (auto &event : buffer->events) write_event(buffer->thread_id, event);
+				buffer->events.clear();
+			}
+		#endif
+	}
+	
+	// Ends the capture, so that the next write_trace() opens a new array, e.g. in a new file.
+	void finish_trace() {
+		trace_array_is_open = false;
+	}
+	
+	// Forgets every span recorded so far, like write_trace() without the writing.
+	void clear_trace() {
+		#ifdef RW_GJK_TRACE
+			lock_guard<mutex> lock(trace_mutex);
+			orphaned_trace_events.clear();
+			for (auto buffer : trace_buffers) buffer->events.clear();
+		#endif
+	}
+	
+	/*
+	A shape is the convex hull of its corners (its "core"), inflated by its rounding. Circles have no
+	corners and are inflated points, capsules are inflated segments, and so on. GJK only ever has to
+	search the core; the rounding is added on at the end of each support query.
+	*/
 	struct Shape {
 		v2 pos;
-		double radius;
+		double radius; // the bounding radius, including the rounding.
 		bool is_circle;
+		bool is_box = false;
+		v2 half_size; // only used by boxes.
 		
 		float angle;
-		vector<v2> corners;
+		
+		// The cos and sin of the angle, cached so that queries don't need to do any trig.
+		float cached_angle = NAN;
+		double angle_cos = 1, angle_sin = 0;
+		
+		/*
+		The corners are in anticlockwise order, and normals[i] is the unit outward normal of the edge from
+		corners[i] to corners[i+1]. They point at memory that the shape doesn't necessarily own, such as a
+		FixedPolygon's arrays. Otherwise owned_geometry keeps whatever they point into alive, e.g. a vector
+		or a mapped file. It's immutable and shared between copies of the shape.
+		*/
+		const v2 *corners = nullptr;
+		const v2 *normals = nullptr;
+		int corner_count = 0;
+		shared_ptr<const void> owned_geometry;
+		
+		double rounding;
+	};
+	
+	/*
+	Refreshes the shape's cached cos and sin if its angle has changed. Every query does this for you,
+	but if multiple threads query the same shape, set its pose with set_pose() beforehand so that the
+	queries only read the shape.
+	*/
+	void update_rotation(Shape *shape) {
+		if (shape->angle == shape->cached_angle) return;
+		
+		shape->cached_angle = shape->angle;
+		#ifdef RW_GJK_DETERMINISTIC
+			bundled_sin_cos(shape->angle, &shape->angle_sin, &shape->angle_cos);
+		#else
+			shape->angle_cos = cos((double)shape->angle);
+			shape->angle_sin = sin((double)shape->angle);
+		#endif
+	}
+	
+	void set_pose(Shape *shape, v2 pos, float angle) {
+		shape->pos = pos;
+		shape->angle = angle;
+		update_rotation(shape);
+	}
+	
+	/*
+	Maps between a shape's own space, where its corners and normals live, and world space. Support
+	queries move the search direction into the shape's space with to_local_direction(), search the
+	shape's untouched corners there, and only move the winning corner back with to_world().
+	*/
+	struct Transform {
+		v2 pos;
+		double angle_cos, angle_sin;
+		
+		v2 to_world(v2 local_point) const {
+			return pos + local_point.rotated(angle_cos, angle_sin);
+		}
+		
+		v2 to_world_direction(v2 local_direction) const {
+			return local_direction.rotated(angle_cos, angle_sin);
+		}
+		
+		v2 to_local_direction(v2 world_direction) const {
+			return world_direction.unrotated(angle_cos, angle_sin);
+		}
 	};
 	
-	bool contains_duplicates(vector<v2> vertices) {
-		for (int i0 = 0; i0 < vertices.size()-1; i0++) {
-			for (int i1 = i0+1; i1 < vertices.size(); i1++) {
+	// The shape's rotation must be up to date, see update_rotation().
+	Transform get_transform(const Shape *shape) {
+		assert(shape->angle == shape->cached_angle);
+		return Transform{ shape->pos, shape->angle_cos, shape->angle_sin };
+	}
+	
+	/*
+	Returns the thickness of simplex lines for a query between the shapes. Every coordinate in the query
+	is roughly as large as the shapes' positions and radii, so float rounding errors are proportional to
+	that size. The thickness is kept a comfortable number of rounding errors above it, so that it never
+	causes IEEE-float-related problems, but is still far too thin to affect the result.
+	*/
+	double get_line_thickness(Shape *shape_a, Shape *shape_b) {
+		const double ROUNDING_ERRORS_PER_THICKNESS = 65536;
+		
+		double scale = fmax(fabs(shape_a->pos.x), fabs(shape_a->pos.y))
+			+ fmax(fabs(shape_b->pos.x), fabs(shape_b->pos.y))
+			+ shape_a->radius + shape_b->radius;
+		
+		return fmax(scale * DBL_EPSILON * ROUNDING_ERRORS_PER_THICKNESS, DBL_MIN);
+	}
+	
+	bool contains_duplicates(const v2 *vertices, int vertex_count) {
+		for (int i0 = 0; i0 < vertex_count-1; i0++) {
+			for (int i1 = i0+1; i1 < vertex_count; i1++) {
 				if (vertices[i0] == vertices[i1]) return true;
 			}
 		}
 		return false;
 	}
 	
-	bool is_convex(vector<v2> corners) {
-		if (corners.size() < 3) return true;
+	bool contains_duplicates(const vector<v2> &vertices) {
+		return contains_duplicates(vertices.data(), vertices.size());
+	}
+	
+	bool is_convex(const v2 *corners, int corner_count) {
+		if (corner_count < 3) return true;
 		
 		// return false if any three points are colinear, i.e. form a straight line.
-		for (int c0 = 0; c0 < corners.size(); c0++) {
-			for (int c1 = 0; c1 < corners.size(); c1++) {
+		for (int c0 = 0; c0 < corner_count; c0++) {
+			for (int c1 = 0; c1 < corner_count; c1++) {
 				if (c1 == c0) continue;
-				for (int c2 = 0; c2 < corners.size(); c2++) {
+				for (int c2 = 0; c2 < corner_count; c2++) {
 					if (c2 == c0 || c2 == c1) continue;
 					
 					v2 a = (corners[c1] - corners[c0]).normalised_or_0();
@@ -73,20 +374,23 @@ namespace rw_gjk {
 		The rest of this function detects concavity by finding the convex hull of all corners using the
 		gift wrapping algorithm (https://en.wikipedia.org/wiki/Gift_wrapping_algorithm). If there are
 		more corners than those that constructed the convex hull, that means the remaining corners are
-		concave.
+		concave. Only the hull's first and latest corners are needed, so it isn't stored.
 		*/
-		vector<v2> convex_hull;
+		v2 first_hull_corner;
+		v2 last_hull_corner;
+		int hull_size = 1;
 		
 		// start with the leftmost corner. If two corners are equally leftmost, choose the upper one.
 		{
-			v2 leftmost_corner = corners.front();
-			for (auto &corner: corners) {
-				if (corner.x < leftmost_corner.x
-					|| (corner.x == leftmost_corner.x && corner.y > leftmost_corner.y)) {
-					leftmost_corner = corner;
+			v2 leftmost_corner = corners[0];
+			for (int c = 0; c < corner_count; c++) {
+				if (corners[c].x < leftmost_corner.x
+					|| (corners[c].x == leftmost_corner.x && corners[c].y > leftmost_corner.y)) {
+					leftmost_corner = corners[c];
 				}
 			}
-			convex_hull.push_back(leftmost_corner);
+			first_hull_corner = leftmost_corner;
+			last_hull_corner = leftmost_corner;
 		}
 		
 		// build a convex shape out of the corners, in any order.
@@ -96,10 +400,10 @@ namespace rw_gjk {
 			int next_corner_index = -1;
 			{
 				double highest_corner_dot = -INFINITY;
-				for (int c = 0; c < corners.size(); c++) {
-					if (corners[c] == convex_hull.back()) continue;
+				for (int c = 0; c < corner_count; c++) {
+					if (corners[c] == last_hull_corner) continue;
 					
-					v2 corner_direction = (corners[c] - convex_hull.back()).normalised_or_0();
+					v2 corner_direction = (corners[c] - last_hull_corner).normalised_or_0();
 					double corner_dot = dot(search_direction, corner_direction);
 					
 					if (corner_dot > highest_corner_dot) {
@@ -110,15 +414,105 @@ namespace rw_gjk {
 			}
 			
 			// check if the new corner is the same as the first corner.
-			if (corners[next_corner_index] == convex_hull[0]) break; // the hull is complete.
+			if (corners[next_corner_index] == first_hull_corner) break; // the hull is complete.
 			else {
 				// add the corner to the shape and update the search direction
-				search_direction = (corners[next_corner_index] - convex_hull.back()).normalised_or_0();
-				convex_hull.push_back(corners[next_corner_index]);
+				search_direction = (corners[next_corner_index] - last_hull_corner).normalised_or_0();
+				last_hull_corner = corners[next_corner_index];
+				hull_size++;
 			}
 		}
 		
-		return corners.size() == convex_hull.size();
+		return corner_count == hull_size;
+	}
+	
+	bool is_convex(const vector<v2> &corners) {
+		return is_convex(corners.data(), corners.size());
+	}
+	
+	// Why some corners can't make a polygon.
+	enum Polygon_error {
+		POLYGON_OK,
+		POLYGON_NAN_CORNER,
+		POLYGON_TOO_FEW_CORNERS,
+		POLYGON_DUPLICATE_CORNERS,
+		POLYGON_NOT_CONVEX, // also covers three corners in a straight line.
+	};
+	
+	Polygon_error get_polygon_error(const v2 *corners, int corner_count) {
+		for (int c = 0; c < corner_count; c++) {
+			if (corners[c].x != corners[c].x || corners[c].y != corners[c].y) return POLYGON_NAN_CORNER;
+		}
+		
+		if (corner_count < 3) return POLYGON_TOO_FEW_CORNERS;
+		if (contains_duplicates(corners, corner_count)) return POLYGON_DUPLICATE_CORNERS;
+		if (!is_convex(corners, corner_count)) return POLYGON_NOT_CONVEX;
+		return POLYGON_OK;
+	}
+	
+	// Returns true if the corners can make a polygon, in any order.
+	bool is_valid_polygon(const v2 *corners, int corner_count) {
+		return get_polygon_error(corners, corner_count) == POLYGON_OK;
+	}
+	
+	// Copies the corners into a vector with room for their normals, so that set_owned_corners() doesn't need to grow it.
+	vector<v2> copy_with_room_for_normals(const v2 *corners, int corner_count) {
+		vector<v2> copy;
+		copy.reserve(corner_count * 2);
+		copy.assign(corners, corners + corner_count);
+		return copy;
+	}
+	
+	/*
+	Sorts convex corners into anticlockwise order around their centre, starting from the -x axis like
+	atan2() does. It compares with cross products rather than atan2(), which is slower and not
+	deterministic across platforms.
+	*/
+	void sort_corners_around_centre(v2 *corners, int corner_count) {
+		v2 centre = ORIGIN;
+		for (int c = 0; c < corner_count; c++) centre = centre + corners[c];
+		centre = centre / corner_count;
+		
+		// the half below the x axis comes first, where atan2() is negative.
+		auto is_in_upper_half = [](v2 offset) {
+			return offset.y > 0 || (offset.y == 0 && offset.x >= 0);
+		};
+		sort(corners, corners + corner_count, [&](const v2 &a, const v2 &b) {
+			v2 offset_a = a - centre;
+			v2 offset_b = b - centre;
+			bool a_is_in_upper_half = is_in_upper_half(offset_a);
+			if (a_is_in_upper_half != is_in_upper_half(offset_b)) return !a_is_in_upper_half;
+			return cross(offset_a, offset_b) > 0;
+		});
+	}
+	
+	void sort_corners_around_centre(vector<v2> &corners) {
+		sort_corners_around_centre(corners.data(), corners.size());
+	}
+	
+	// Computes the normals of corners that are already in anticlockwise order.
+	void compute_normals(const v2 *corners, int corner_count, v2 *normals_out) {
+		for (int c = 0; c < corner_count; c++) {
+			v2 next_corner = corners[(c+1) % corner_count];
+			normals_out[c] = (next_corner - corners[c]).right_normal_or_0();
+		}
+	}
+	
+	/*
+	Makes the shape own the corners, which must already be in anticlockwise order, and their normals.
+	The normals are appended to the corners' own vector, so this only allocates the shared_ptr's
+	control block if the vector already has room for twice as many corners.
+	*/
+	void set_owned_corners(vector<v2> &&corners, Shape *shape) {
+		int corner_count = corners.size();
+		corners.resize(corner_count * 2);
+		compute_normals(corners.data(), corner_count, corners.data() + corner_count);
+		
+		shared_ptr<const vector<v2>> geometry = make_shared<vector<v2>>(move(corners));
+		shape->owned_geometry = geometry;
+		shape->corners = geometry->data();
+		shape->normals = geometry->data() + corner_count;
+		shape->corner_count = corner_count;
 	}
 	
 	void make_circle(double radius, Shape *shape_out) {
@@ -127,224 +521,2310 @@ namespace rw_gjk {
 		shape_out->pos = ORIGIN;
 		shape_out->angle = 0;
 		shape_out->is_circle = true;
+		shape_out->is_box = false;
+		shape_out->corners = nullptr;
+		shape_out->normals = nullptr;
+		shape_out->corner_count = 0;
+		shape_out->owned_geometry.reset();
+		shape_out->rounding = radius;
 	}
 	
-	bool try_make_polygon(vector<v2> corners, Shape *shape_out) {
-		
-		// Check for NAN
-		for (auto &corner : corners) {
-			if (corner.x != corner.x || corner.y != corner.y) return false;
-		}
-		
-		if (corners.size() < 3) {
-			return false;
-		}
-		
-		if (contains_duplicates(corners)) {
-			return false;
-		}
-		
-		if (!is_convex(corners)) {
-			return false;
-		}
+	// A line segment between two corners, with no area.
+	bool try_make_segment(v2 corner_a, v2 corner_b, Shape *shape_out) {
+		if (corner_a.x != corner_a.x || corner_a.y != corner_a.y) return false;
+		if (corner_b.x != corner_b.x || corner_b.y != corner_b.y) return false;
+		if (corner_a == corner_b) return false;
 		
 		if (shape_out) {
 			shape_out->pos = ORIGIN;
 			shape_out->angle = 0;
 			shape_out->is_circle = false;
-			shape_out->corners = corners;
-			
-			// set radius
-			shape_out->radius = 0;
-			for (auto &corner: shape_out->corners) {
-				if (corner.length() > shape_out->radius) shape_out->radius = corner.length();
-			}
-			
+			shape_out->is_box = false;
+			v2 corners[] = {corner_a, corner_b};
+			set_owned_corners(copy_with_room_for_normals(corners, 2), shape_out);
+			shape_out->rounding = 0;
+			shape_out->radius = fmax(corner_a.length(), corner_b.length());
 			return true;
 		} else {
 			return false;
 		}
 	}
 	
-	v2 get_minkowski_diffed_corner(Shape *shape, Shape *other_shape, v2 direction) {
-		assert(!direction.is_0());
+	// A segment inflated by a radius, i.e. a "pill" shape.
+	bool try_make_capsule(v2 corner_a, v2 corner_b, double radius, Shape *shape_out) {
+		if (!(radius >= 0)) return false; // also catches NAN
+		if (!try_make_segment(corner_a, corner_b, shape_out)) return false;
 		
-		auto get_baked_corner_of_shape = [](Shape *shape, v2 corner_direction) {
-			if (shape->is_circle) {
-				return shape->pos + (corner_direction.normalised_or_0() * shape->radius);
-			} else {
-				v2 best_rotated_corner;
-				double best_dot = -INFINITY;
-				
-				for (const auto &corner: shape->corners) {
-					v2 rotated_corner = corner.rotated(shape->angle);
-					double new_dot = dot(rotated_corner, corner_direction);
-					
-					if (new_dot > best_dot) {
-						best_rotated_corner = rotated_corner;
-						best_dot = new_dot;
-					}
-				}
-				
-				return shape->pos + best_rotated_corner;
-			}
+		shape_out->rounding = radius;
+		shape_out->radius += radius;
+		return true;
+	}
+	
+	// Sorts and bakes corners that have already been validated into the shape, which owns them after.
+	void make_validated_polygon(vector<v2> &&corners, double rounding, Shape *shape_out) {
+		shape_out->pos = ORIGIN;
+		shape_out->angle = 0;
+		shape_out->is_circle = false;
+		shape_out->is_box = false;
+		sort_corners_around_centre(corners);
+		set_owned_corners(move(corners), shape_out);
+		shape_out->rounding = rounding;
+		
+		// set radius
+		shape_out->radius = 0;
+		for (int c = 0; c < shape_out->corner_count; c++) {
+			shape_out->radius = fmax(shape_out->radius, shape_out->corners[c].length());
+		}
+		shape_out->radius += rounding;
+	}
+	
+	/*
+	Note that the shape's corners are reordered to go anticlockwise. The corners are moved into the
+	shape rather than copied, but only if they make a valid polygon; otherwise they're left untouched.
+	Reserve room for twice as many corners beforehand and this makes just one small allocation.
+	*/
+	bool try_make_polygon(vector<v2> &&corners, Shape *shape_out) {
+		if (!is_valid_polygon(corners.data(), corners.size()) || !shape_out) return false;
+		
+		make_validated_polygon(move(corners), 0, shape_out);
+		return true;
+	}
+	
+	// Copies the corners, e.g. from a larger vertex buffer, into a new polygon.
+	bool try_make_polygon(const v2 *corners, int corner_count, Shape *shape_out) {
+		if (!is_valid_polygon(corners, corner_count) || !shape_out) return false;
+		
+		make_validated_polygon(copy_with_room_for_normals(corners, corner_count), 0, shape_out);
+		return true;
+	}
+	
+	bool try_make_polygon(const vector<v2> &corners, Shape *shape_out) {
+		return try_make_polygon(corners.data(), corners.size(), shape_out);
+	}
+	
+	/*
+	A rectangle centred on the shape's position. It's a polygon like any other, except that its support
+	corner comes straight from the signs of the search direction, and pairs of boxes have their own
+	separating axis test that only needs to check two axes per box.
+	*/
+	bool try_make_box(double width, double height, Shape *shape_out) {
+		if (!(width > 0 && height > 0)) return false; // also catches NAN
+		
+		double half_width = width / 2;
+		double half_height = height / 2;
+		v2 corners[] = {
+			v2(-half_width, -half_height), v2(half_width, -half_height),
+			v2(half_width, half_height), v2(-half_width, half_height)
 		};
+		if (!try_make_polygon(corners, 4, shape_out)) return false;
 		
-		v2 baked_corner = get_baked_corner_of_shape(shape, direction);
-		v2 other_baked_corner = get_baked_corner_of_shape(other_shape, -direction);
+		shape_out->is_box = true;
+		shape_out->half_size = v2(half_width, half_height);
+		return true;
+	}
+	
+	// A polygon with its corners rounded off, i.e. the polygon inflated by the rounding amount.
+	bool try_make_rounded_polygon(vector<v2> &&corners, double rounding, Shape *shape_out) {
+		if (!(rounding >= 0)) return false; // also catches NAN
+		if (!is_valid_polygon(corners.data(), corners.size()) || !shape_out) return false;
 		
-		return baked_corner - other_baked_corner;
+		make_validated_polygon(move(corners), rounding, shape_out);
+		return true;
 	}
 	
-	bool origin_is_between_points(v2 a, v2 b) {
-		v2 ao = ORIGIN - a;
-		v2 bo = ORIGIN - b;
-		v2 ab = b - a;
-		v2 ba = a - b;
-		return (dot(ao, ab) >= 0) && (dot(bo, ba) >= 0);
+	bool try_make_rounded_polygon(const vector<v2> &corners, double rounding, Shape *shape_out) {
+		if (!(rounding >= 0)) return false; // also catches NAN
+		if (!is_valid_polygon(corners.data(), corners.size()) || !shape_out) return false;
+		
+		make_validated_polygon(copy_with_room_for_normals(corners.data(), corners.size()), rounding, shape_out);
+		return true;
 	}
 	
-	bool improve_2_simplex(vector<v2> &simplex, v2 &search_direction) {
-		/*
-		Find which simplex component the origin is closest
-		to, or whether it is on the simplex line itself.
-		*/
-		if (origin_is_between_points(simplex[0], simplex[1])) {
-			v2 line_normal = (simplex[1] - simplex[0]).right_normal_or_0();
-			double origin_distance_from_line = dot(line_normal, ORIGIN - simplex[0]);
-			
-			if (fabs(origin_distance_from_line) <= LINE_THICKNESS) {
-				return true; // The simplex contains the origin.
-			} else {
-				// The simplex is correct. Search on the side of the 2-simplex that contains the origin.
-				search_direction = (simplex[1] - simplex[0]).normal_in_direction_or_0(ORIGIN - simplex[0]);
-			}
-		} else if (dot(simplex[1] - simplex[0], ORIGIN - simplex[0]) <= 0) {
-			simplex = {simplex[0]}; // The origin is closest to point 0.
-			search_direction = (ORIGIN - simplex[0]).normalised_or_0();
-		} else {
-			assert(dot(simplex[0] - simplex[1], ORIGIN - simplex[1]) <= 0);
-			simplex = {simplex[1]}; // The origin is closest to point 1.
-			search_direction = (ORIGIN - simplex[1]).normalised_or_0();
+	/*
+	Makes a polygon that is shrunk by the margin and then rounded by the same amount. The result is the
+	original polygon with slightly rounded-off corners, which lets get_overlap_amount() skip EPA for
+	overlaps shallower than twice the margin. Returns false if the margin is too large for the polygon.
+	*/
+	bool try_make_polygon_with_margin(const vector<v2> &unsorted_corners, double margin, Shape *shape_out) {
+		if (!(margin >= 0)) return false; // also catches NAN
+		if (!is_valid_polygon(unsorted_corners.data(), unsorted_corners.size()) || !shape_out) return false;
+		
+		vector<v2> corners = unsorted_corners;
+		sort_corners_around_centre(corners);
+		vector<v2> normals(corners.size());
+		compute_normals(corners.data(), corners.size(), normals.data());
+		
+		// move each corner inward along the bisector of its two edges' normals.
+		vector<v2> shrunk_corners;
+		shrunk_corners.reserve(corners.size() * 2);
+		for (int c = 0; c < corners.size(); c++) {
+			v2 prev_normal = normals[(c + corners.size() - 1) % corners.size()];
+			v2 next_normal = normals[c];
+			v2 offset = (prev_normal + next_normal) * (margin / (1 + dot(prev_normal, next_normal)));
+			shrunk_corners.push_back(corners[c] - offset);
 		}
 		
-		return false;
+		// if any edge has flipped direction, the margin was too large.
+		for (int c = 0; c < corners.size(); c++) {
+			int next = (c+1) % corners.size();
+			if (dot(shrunk_corners[next] - shrunk_corners[c], corners[next] - corners[c]) <= 0) return false;
+		}
+		
+		return try_make_rounded_polygon(move(shrunk_corners), margin, shape_out);
 	}
 	
-	// returns true when the simplex contains the origin.
-	bool improve_simplex(vector<v2> &simplex, v2 &search_direction) {
-		assert(simplex.size() <= 3);
+	// Calls function(i) for every i from 0 to count-1, split into contiguous runs across the threads.
+	template <typename Function>
+	void for_each_index_in_parallel(int count, int thread_count, Function function) {
+		thread_count = max(1, min(thread_count, count));
+		auto run_part = [&](int part) {
+			RW_GJK_TRACE_SPAN("parallel part");
+			int end = (long)count * (part+1) / thread_count;
+			for (int i = (long)count * part / thread_count; i < end; i++) function(i);
+		};
 		
-		if (simplex.size() == 3) {
-			// cache some basic vectors
-			v2 ab = simplex[1] - simplex[0];
-			v2 bc = simplex[2] - simplex[1];
-			v2 ca = simplex[0] - simplex[2];
-			
-			v2 ab_normal_away_from_c = ab.normal_in_direction_or_0(ca);
-			v2 bc_normal_away_from_a = bc.normal_in_direction_or_0(ab);
-			v2 ca_normal_away_from_b = ca.normal_in_direction_or_0(bc);
+		vector<thread> threads;
+		for (int part = 1; part < thread_count; part++) threads.emplace_back(run_part, part);
+		run_part(0); // the calling thread does its share too.
+		for (auto &thread_ : threads) thread_.join();
+	}
+	
+	/*
+	Like for_each_index_in_parallel(), but for loops that run many times in a row, such as a solver's
+	iterations: the threads are started once by the constructor and wait between loops, rather than
+	being started and joined every time. The calling thread still does the first share of each loop.
+	*/
+	class Thread_team {
+	public:
+		explicit Thread_team(int thread_count) {
+			for (int part = 1; part < thread_count; part++) workers.emplace_back(&Thread_team::run_worker, this, part);
+		}
+		
+		~Thread_team() {
+			{
+				lock_guard<mutex> lock(team_mutex);
+				stopping = true;
+			}
+			loop_started.notify_all();
+			for (auto &worker : workers) worker.join();
+		}
+		
+		Thread_team(const Thread_team &) = delete;
+		Thread_team &operator=(const Thread_team &) = delete;
+		
+		// Calls function(i) for every i from 0 to count-1, and returns once they've all finished.
+		template <typename Function>
+		void for_each_index(int count, Function function) {
+			int thread_count = workers.size() + 1;
+			auto run_part = [&](int part) {
+				RW_GJK_TRACE_SPAN("parallel part");
+				int end = (long)count * (part+1) / thread_count;
+				for (int i = (long)count * part / thread_count; i < end; i++) function(i);
+			};
+			if (workers.empty()) {
+				run_part(0);
+				return;
+			}
 			
-			// find which side of the triangle the origin is on, or if it's inside it.
-			if (dot(ab_normal_away_from_c, ORIGIN - simplex[0]) > 0) {
-				simplex = {simplex[0], simplex[1]};
-			} else if (dot(bc_normal_away_from_a, ORIGIN - simplex[1]) > 0) {
-				simplex = {simplex[1], simplex[2]};
-			} else if (dot(ca_normal_away_from_b, ORIGIN - simplex[2]) > 0) {
-				simplex = {simplex[2], simplex[0]};
-			} else {
-				return true; // the origin is inside the simplex.
+			{
+				lock_guard<mutex> lock(team_mutex);
+				current_loop = run_part;
+				unfinished_parts = workers.size();
+				loop_count++;
 			}
+			loop_started.notify_all();
+			run_part(0); // the calling thread does its share too.
+			
+			unique_lock<mutex> lock(team_mutex);
+			loop_finished.wait(lock, [&]() { return unfinished_parts == 0; });
+			current_loop = nullptr;
 		}
 		
-		return improve_2_simplex(simplex, search_direction);
-	}
+	private:
+		mutex team_mutex;
+		condition_variable loop_started;
+		condition_variable loop_finished;
+		function<void(int)> current_loop;
+		int unfinished_parts = 0;
+		long loop_count = 0;
+		bool stopping = false;
+		vector<thread> workers;
+		
+		// Runs on each worker thread.
+		void run_worker(int part) {
+			long loops_run = 0;
+			while (true) {
+				{
+					unique_lock<mutex> lock(team_mutex);
+					loop_started.wait(lock, [&]() { return stopping || loop_count != loops_run; });
+					if (stopping) return;
+					loops_run = loop_count;
+				}
+				
+				current_loop(part);
+				
+				lock_guard<mutex> lock(team_mutex);
+				if (--unfinished_parts == 0) loop_finished.notify_one();
+			}
+		}
+	};
 	
-	bool shapes_are_overlapping(
-		Shape *shape_a, Shape *shape_b,
-		vector<v2> *simplex_out = nullptr // This is only used internally.
-		) {
+	/*
+	Makes many polygons at once, e.g. for a chunk of a level as it streams in. The corners of polygon i
+	are vertices[offsets[i]] up to vertices[offsets[i+1]], so there are polygon_count+1 offsets.
+	
+	Instead of each shape owning its own geometry, every polygon's corners and normals are put in one
+	pool that's allocated up front and shared by all the shapes, and that's freed with the last of them.
+	The polygons are validated, sorted and baked across thread_count threads (including the calling
+	one). errors_out gets a code for every polygon; the shapes of invalid polygons are left untouched.
+	Returns how many polygons were valid.
+	*/
+	int make_polygons(
+		const v2 *vertices, const int *offsets, int polygon_count,
+		Shape *shapes_out, Polygon_error *errors_out, int thread_count = 1) {
 		
-		// setting the initial direction like this maximises the
-		// chance of the simplex covering the origin early. TODO: does it actually tho?
-		v2 search_direction = (shape_b->pos - shape_a->pos).right_normal_or_0();
-		if (search_direction.is_0()) search_direction = v2(1, 0);
+		RW_GJK_TRACE_SPAN("make_polygons");
 		
-		vector<v2> simplex = { get_minkowski_diffed_corner(shape_a, shape_b, search_direction) };
-		search_direction = ORIGIN - simplex[0]; // search toward the origin
+		// every vertex gets a slot for itself and one for its edge's normal.
+		int vertex_count = offsets[polygon_count] - offsets[0];
+		auto pool = make_shared<vector<v2>>(vertex_count * 2);
+		v2 *pool_corners = pool->data();
+		v2 *pool_normals = pool->data() + vertex_count;
+		shared_ptr<const vector<v2>> geometry = pool;
 		
-		while (true) {
-			simplex.push_back(get_minkowski_diffed_corner(shape_a, shape_b, search_direction));
+		for_each_index_in_parallel(polygon_count, thread_count, [&](int p) {
+			const v2 *corners = vertices + offsets[p];
+			int corner_count = offsets[p+1] - offsets[p];
 			
-			if (dot(simplex.back(), search_direction) <= LINE_THICKNESS) return false;
+			errors_out[p] = get_polygon_error(corners, corner_count);
+			if (errors_out[p] != POLYGON_OK) return;
 			
-			if (improve_simplex(simplex, search_direction)) {
-				if (simplex_out != nullptr) *simplex_out = simplex;
-				return true;
+			v2 *pooled_corners = pool_corners + offsets[p] - offsets[0];
+			v2 *pooled_normals = pool_normals + offsets[p] - offsets[0];
+			copy(corners, corners + corner_count, pooled_corners);
+			sort_corners_around_centre(pooled_corners, corner_count);
+			compute_normals(pooled_corners, corner_count, pooled_normals);
+			
+			Shape *shape = &shapes_out[p];
+			shape->pos = ORIGIN;
+			shape->angle = 0;
+			shape->is_circle = false;
+			shape->is_box = false;
+			shape->corners = pooled_corners;
+			shape->normals = pooled_normals;
+			shape->corner_count = corner_count;
+			shape->owned_geometry = geometry; // shared_ptr copies are thread-safe.
+			shape->rounding = 0;
+			
+			// set radius
+			shape->radius = 0;
+			for (int c = 0; c < corner_count; c++) {
+				shape->radius = fmax(shape->radius, pooled_corners[c].length());
 			}
+		});
+		
+		int valid_polygon_count = 0;
+		for (int p = 0; p < polygon_count; p++) valid_polygon_count += errors_out[p] == POLYGON_OK;
+		return valid_polygon_count;
+	}
+	
+	// Lets FixedPolygon build its normals at compile time. C++11 constexpr functions can't loop, hence the recursion.
+	namespace compile_time {
+		template <int... INDICES> struct Index_list {};
+		template <int COUNT, int... INDICES> struct Make_index_list : Make_index_list<COUNT-1, COUNT-1, INDICES...> {};
+		template <int... INDICES> struct Make_index_list<0, INDICES...> { typedef Index_list<INDICES...> type; };
+		
+		constexpr double absolute(double x) {
+			return x < 0 ? -x : x;
+		}
+		
+		// Newton's method, for numbers between 1 and 2.
+		constexpr double square_root_of_small_number(double x, double guess = 1.5, int iterations_left = 8) {
+			return iterations_left == 0 ? guess : square_root_of_small_number(x, (guess + x/guess) / 2, iterations_left - 1);
+		}
+		
+		// Scale the vector so that its larger component is 1 before normalising it, to keep the square root cheap.
+		constexpr v2 normalised_scaled(v2 v) {
+			return v / square_root_of_small_number(dot(v, v));
+		}
+		
+		constexpr v2 right_normal_or_0(v2 v) {
+			return v.x == 0 && v.y == 0 ? v2(0, 0)
+				: normalised_scaled(v2(v.y, -v.x) / (absolute(v.x) > absolute(v.y) ? absolute(v.x) : absolute(v.y)));
 		}
 	}
 	
-	// Returns the amount that a is overlapping b.
-	// Negating this amount from a->pos will resolve the overlap.
-	v2 get_overlap_amount(Shape *shape_a, Shape *shape_b) {
-		vector<v2> simplex;
+	/*
+	A polygon whose corners are stored inline rather than on the heap, and that can be built and
+	validated at compile time. The corners must be given in anticlockwise order. For example:
+	
+	constexpr FixedPolygon<3> TRIANGLE(v2(0, 0), v2(1, 0), v2(0, 1));
+	static_assert(TRIANGLE.is_valid(), "TRIANGLE isn't convex");
+	
+	Use try_make_polygon() to point a Shape at it, after which it can be used like any other shape.
+	*/
+	template <int CORNER_COUNT>
+	struct FixedPolygon {
+		static_assert(CORNER_COUNT >= 3, "A polygon needs at least three corners");
 		
-		if (!shapes_are_overlapping(shape_a, shape_b, &simplex)) {
-			return v2(0, 0); // no overlap, therefore no overlap amount.
+		v2 corners[CORNER_COUNT];
+		v2 normals[CORNER_COUNT];
+		
+		template <typename... Corners>
+		constexpr FixedPolygon(v2 first_corner, Corners... other_corners)
+			: FixedPolygon(Corner_list{{first_corner, other_corners...}},
+				typename compile_time::Make_index_list<CORNER_COUNT>::type()) {
+			static_assert(1 + sizeof...(Corners) == CORNER_COUNT, "Wrong number of corners");
 		}
 		
-		if (simplex.size() < 3) {
-			v2 pos_vector = (shape_b->pos - shape_a->pos).normalised_or_0();
-			if (pos_vector.is_0()) pos_vector.x = 1;
-			return pos_vector * LINE_THICKNESS;
+		// Returns true if the corners are anticlockwise, convex, and with no three in a line.
+		constexpr bool is_valid(int edge = 0) const {
+			return edge == CORNER_COUNT || (corners_are_left_of_edge(edge) && is_valid(edge + 1));
 		}
 		
-		while (true) {
-			const double CORNER_SIMILARITY_TOLERANCE = LINE_THICKNESS; // TODO: better way to set this?
+		private:
+		struct Corner_list {
+			v2 corners[CORNER_COUNT];
+		};
+		
+		template <int... INDICES>
+		constexpr FixedPolygon(Corner_list list, compile_time::Index_list<INDICES...>)
+			: corners{list.corners[INDICES]...},
+			normals{compile_time::right_normal_or_0(list.corners[(INDICES+1) % CORNER_COUNT] - list.corners[INDICES])...} {}
+		
+		constexpr bool corners_are_left_of_edge(int edge, int corner = 0) const {
+			return corner == CORNER_COUNT || (
+				(corner == edge || corner == (edge+1) % CORNER_COUNT
+					|| cross(corners[(edge+1) % CORNER_COUNT] - corners[edge], corners[corner] - corners[edge]) > 0)
+				&& corners_are_left_of_edge(edge, corner + 1));
+		}
+	};
+	
+	// Points the shape at the polygon's corners and normals without copying them, so the polygon must outlive the shape.
+	template <int CORNER_COUNT>
+	bool try_make_polygon(const FixedPolygon<CORNER_COUNT> &polygon, Shape *shape_out) {
+		if (!polygon.is_valid()) return false;
+		
+		if (shape_out) {
+			shape_out->pos = ORIGIN;
+			shape_out->angle = 0;
+			shape_out->is_circle = false;
+			shape_out->is_box = false;
+			shape_out->corners = polygon.corners;
+			shape_out->normals = polygon.normals;
+			shape_out->corner_count = CORNER_COUNT;
+			shape_out->owned_geometry.reset();
+			shape_out->rounding = 0;
 			
-			// get simplex line closest to origin.
-			double closest_line_distance = INFINITY;
-			int line_start_index = -1;
-			for (int s0 = 0; s0 < simplex.size(); s0++) {
-				int s1 = (s0+1) % simplex.size();
-				v2 simplex_line_normal = (simplex[s1] - simplex[s0]).right_normal_or_0();
-				
-				double line_distance = fabs(dot(simplex_line_normal, ORIGIN - simplex[s0]));
-				
-				if (line_distance < closest_line_distance) {
-					line_start_index = s0;
-					closest_line_distance = line_distance;
-				}
+			// set radius
+			shape_out->radius = 0;
+			for (auto &corner: polygon.corners) {
+				if (corner.length() > shape_out->radius) shape_out->radius = corner.length();
 			}
 			
-			// get the outer normal of that line and get the minkowski diffed corner in that direction.
-			int line_end_index = (line_start_index+1) % simplex.size();
+			return true;
+		} else {
+			return false;
+		}
+	}
+	
+	/*
+	Cooked shape files hold shapes that have already been validated, sorted and baked, so that they can
+	be loaded without doing any of that again. They're laid out exactly as the shapes use them in memory:
+	
+		Cooked_header
+		Cooked_shape shapes[shape_count]
+		v2 corners[vertex_count]
+		v2 normals[vertex_count]
+	
+	Everything is in the byte order of the machine that cooked it. A file from a machine with a different
+	byte order fails the version check, so cook shapes on the platform that loads them.
+	*/
+	const char COOKED_MAGIC[8] = { 'R', 'W', 'G', 'J', 'K', 'C', 'S', 'F' };
+	const uint32_t COOKED_VERSION = 1;
+	
+	struct Cooked_header {
+		char magic[8];
+		uint32_t version;
+		uint32_t flags; // reserved for optional sections, always 0 in version 1.
+		uint32_t shape_count;
+		uint32_t vertex_count;
+	};
+	
+	enum Cooked_shape_flags {
+		COOKED_SHAPE_CIRCLE = 1,
+		COOKED_SHAPE_BOX = 2,
+	};
+	
+	struct Cooked_shape {
+		uint32_t first_vertex;
+		uint32_t corner_count;
+		uint32_t flags;
+		uint32_t padding;
+		double radius;
+		double rounding;
+		v2 half_size;
+	};
+	
+	// Writes the shapes' geometry to a cooked shape file. Their poses aren't saved. Returns false if the file can't be written.
+	bool write_cooked_shapes(const string &path, const Shape *shapes, int shape_count) {
+		Cooked_header header = {};
+		copy(COOKED_MAGIC, COOKED_MAGIC + 8, header.magic);
+		header.version = COOKED_VERSION;
+		header.shape_count = shape_count;
+		
+		vector<Cooked_shape> cooked_shapes(shape_count);
+		for (int s = 0; s < shape_count; s++) {
+			Cooked_shape &cooked_shape = cooked_shapes[s];
+			cooked_shape.first_vertex = header.vertex_count;
+			cooked_shape.corner_count = shapes[s].corner_count;
+			cooked_shape.flags = (shapes[s].is_circle ? COOKED_SHAPE_CIRCLE : 0) | (shapes[s].is_box ? COOKED_SHAPE_BOX : 0);
+			cooked_shape.padding = 0;
+			cooked_shape.radius = shapes[s].radius;
+			cooked_shape.rounding = shapes[s].rounding;
+			cooked_shape.half_size = shapes[s].is_box ? shapes[s].half_size : v2(0, 0);
+			header.vertex_count += shapes[s].corner_count;
+		}
+		
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file) return false;
+		
+		// circles have no corners and null pointers to them, which fwrite() mustn't be given even for nothing.
+		auto write_items = [&](const void *items, size_t item_size, size_t item_count) {
+			return item_count == 0 || fwrite(items, item_size, item_count, file) == item_count;
+		};
+		
+		bool success = write_items(&header, sizeof(header), 1)
+			&& write_items(cooked_shapes.data(), sizeof(Cooked_shape), shape_count);
+		for (int s = 0; s < shape_count && success; s++) {
+			success = write_items(shapes[s].corners, sizeof(v2), shapes[s].corner_count);
+		}
+		for (int s = 0; s < shape_count && success; s++) {
+			success = write_items(shapes[s].normals, sizeof(v2), shapes[s].corner_count);
+		}
+		
+		return fclose(file) == 0 && success;
+	}
+	
+	/*
+	Points the shapes at geometry in a cooked shape file, which is already laid out as they need it.
+	Returns false and leaves shapes_out untouched if the data isn't a valid cooked shape file. Only the
+	layout is checked; the shapes themselves are trusted to have been valid when they were cooked. The
+	data must be aligned for doubles, which memory from mmap() or operator new always is.
+	*/
+	bool try_load_cooked_shapes(shared_ptr<const void> data, size_t size, vector<Shape> *shapes_out) {
+		const char *bytes = (const char *)data.get();
+		// every section's size is a multiple of 8 bytes, so an aligned start keeps every section aligned.
+		static_assert(sizeof(Cooked_header) % alignof(v2) == 0 && sizeof(Cooked_shape) % alignof(v2) == 0
+			&& alignof(Cooked_shape) <= alignof(v2), "cooked sections must stay aligned");
+		assert((uintptr_t)bytes % alignof(v2) == 0);
+		if (size < sizeof(Cooked_header)) return false;
+		
+		const Cooked_header *header = (const Cooked_header *)bytes;
+		if (!equal(COOKED_MAGIC, COOKED_MAGIC + 8, header->magic)) return false;
+		if (header->version != COOKED_VERSION || header->flags != 0) return false;
+		
+		size_t shapes_offset = sizeof(Cooked_header);
+		size_t corners_offset = shapes_offset + (size_t)header->shape_count * sizeof(Cooked_shape);
+		size_t normals_offset = corners_offset + (size_t)header->vertex_count * sizeof(v2);
+		if (size != normals_offset + (size_t)header->vertex_count * sizeof(v2)) return false;
+		
+		const Cooked_shape *cooked_shapes = (const Cooked_shape *)(bytes + shapes_offset);
+		const v2 *corners = (const v2 *)(bytes + corners_offset);
+		const v2 *normals = (const v2 *)(bytes + normals_offset);
+		
+		for (uint32_t s = 0; s < header->shape_count; s++) {
+			if (cooked_shapes[s].first_vertex > header->vertex_count
+				|| cooked_shapes[s].corner_count > header->vertex_count - cooked_shapes[s].first_vertex) return false;
+		}
+		
+		shapes_out->resize(header->shape_count);
+		for (uint32_t s = 0; s < header->shape_count; s++) {
+			const Cooked_shape &cooked_shape = cooked_shapes[s];
+			Shape &shape = (*shapes_out)[s];
+			shape.pos = ORIGIN;
+			shape.angle = 0;
+			shape.is_circle = cooked_shape.flags & COOKED_SHAPE_CIRCLE;
+			shape.is_box = cooked_shape.flags & COOKED_SHAPE_BOX;
+			shape.half_size = cooked_shape.half_size;
+			shape.corners = cooked_shape.corner_count ? corners + cooked_shape.first_vertex : nullptr;
+			shape.normals = cooked_shape.corner_count ? normals + cooked_shape.first_vertex : nullptr;
+			shape.corner_count = cooked_shape.corner_count;
+			shape.owned_geometry = data;
+			shape.rounding = cooked_shape.rounding;
+			shape.radius = cooked_shape.radius;
+		}
+		
+		return true;
+	}
+	
+	#ifdef RW_GJK_HAS_MMAP
+		/*
+		Maps a cooked shape file into memory and points the shapes straight into it, so nothing is parsed
+		or copied. The file stays mapped until the last shape that uses it is gone.
+		*/
+		bool try_load_cooked_shapes(const string &path, vector<Shape> *shapes_out) {
+			int file = open(path.c_str(), O_RDONLY);
+			if (file < 0) return false;
+			
+			struct stat file_status;
+			bool success = fstat(file, &file_status) == 0 && file_status.st_size > 0;
+			size_t size = success ? file_status.st_size : 0;
+			void *mapping = success ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+			close(file); // the mapping keeps the file open.
+			if (mapping == MAP_FAILED) return false;
+			
+			shared_ptr<const void> data(mapping, [size](const void *mapping) { munmap((void *)mapping, size); });
+			return try_load_cooked_shapes(data, size, shapes_out);
+		}
+	#endif
+	
+	// A batch of shapes from a Shape_stream, with the validation result of each one.
+	struct Shape_chunk {
+		vector<Shape> shapes;
+		vector<Polygon_error> errors; // invalid polygons' shapes are left default-constructed.
+	};
+	
+	/*
+	Reads polygon definitions from a file or pipe on a background thread, and validates and bakes them
+	in chunks with make_polygons() while the caller carries on. Each definition is an int32_t corner
+	count followed by that many pairs of doubles, in the machine's byte order.
+	
+	At most max_waiting_chunks finished chunks wait to be taken. The background thread stops reading
+	while the queue is full, so memory use is bounded by the chunk window rather than by the stream.
+	The stream doesn't own the file; it must stay open until the Shape_stream is destroyed. To put the
+	shapes in a World as they arrive, call World::add_streamed_shapes() instead of taking the chunks.
+	*/
+	class Shape_stream {
+	public:
+		Shape_stream(FILE *file, int shapes_per_chunk = 1024, int max_waiting_chunks = 4, int validation_thread_count = 1)
+			: file(file), shapes_per_chunk(shapes_per_chunk), max_waiting_chunks(max_waiting_chunks),
+			validation_thread_count(validation_thread_count) {
+			
+			assert(shapes_per_chunk > 0 && max_waiting_chunks > 0);
+			reader = thread(&Shape_stream::read_chunks, this);
+		}
+		
+		// Waits for the background thread's current read to return, which might block on a pipe.
+		~Shape_stream() {
+			{
+				lock_guard<mutex> lock(queue_mutex);
+				stopping = true;
+			}
+			queue_space_freed.notify_all();
+			reader.join();
+		}
+		
+		Shape_stream(const Shape_stream &) = delete;
+		Shape_stream &operator=(const Shape_stream &) = delete;
+		
+		// Moves the next finished chunk into chunk_out without waiting. Returns false if none is ready yet.
+		bool try_take_chunk(Shape_chunk *chunk_out) {
+			{
+				lock_guard<mutex> lock(queue_mutex);
+				if (waiting_chunks.empty()) return false;
+				
+				*chunk_out = move(waiting_chunks.front());
+				waiting_chunks.pop_front();
+			}
+			queue_space_freed.notify_one();
+			return true;
+		}
+		
+		// True once the whole stream has been read and every chunk has been taken.
+		bool is_finished() {
+			lock_guard<mutex> lock(queue_mutex);
+			return reached_end && waiting_chunks.empty();
+		}
+		
+		// True if the stream ended partway through a definition, or a definition had an absurd corner count.
+		bool had_read_error() {
+			lock_guard<mutex> lock(queue_mutex);
+			return read_error;
+		}
+		
+	private:
+		// The most corners a definition can claim before the stream is assumed to be corrupt.
+		static const int MAX_CORNER_COUNT = 1 << 16;
+		
+		FILE *file;
+		int shapes_per_chunk;
+		int max_waiting_chunks;
+		int validation_thread_count;
+		
+		mutex queue_mutex;
+		condition_variable queue_space_freed;
+		deque<Shape_chunk> waiting_chunks;
+		bool stopping = false;
+		bool reached_end = false;
+		bool read_error = false;
+		thread reader;
+		
+		// Runs on the background thread.
+		void read_chunks() {
+			vector<v2> vertices;
+			vector<int> offsets;
+			
+			while (true) {
+				vertices.clear();
+				offsets.assign(1, 0);
+				bool stream_ended = false;
+				bool stream_corrupt = false;
+				
+				while (offsets.size() <= shapes_per_chunk) {
+					int32_t corner_count;
+					if (fread(&corner_count, sizeof(corner_count), 1, file) != 1) {
+						stream_ended = true;
+						stream_corrupt = ferror(file);
+						break;
+					}
+					if (corner_count < 0 || corner_count > MAX_CORNER_COUNT) {
+						stream_ended = stream_corrupt = true;
+						break;
+					}
+					
+					vertices.resize(vertices.size() + corner_count);
+					if (fread(vertices.data() + vertices.size() - corner_count, sizeof(v2), corner_count, file) != (size_t)corner_count) {
+						stream_ended = stream_corrupt = true;
+						vertices.resize(offsets.back()); // drop the partial definition.
+						break;
+					}
+					offsets.push_back(vertices.size());
+				}
+				
+				int shape_count = offsets.size() - 1;
+				Shape_chunk chunk;
+				chunk.shapes.resize(shape_count);
+				chunk.errors.resize(shape_count);
+				if (shape_count > 0) {
+					make_polygons(vertices.data(), offsets.data(), shape_count,
+						chunk.shapes.data(), chunk.errors.data(), validation_thread_count);
+				}
+				
+				unique_lock<mutex> lock(queue_mutex);
+				queue_space_freed.wait(lock, [&]() { return stopping || waiting_chunks.size() < max_waiting_chunks; });
+				if (stopping) return;
+				
+				if (shape_count > 0) waiting_chunks.push_back(move(chunk));
+				if (stream_ended) {
+					reached_end = true;
+					read_error = stream_corrupt;
+					return;
+				}
+			}
+		}
+	};
+	
+	// Returns the normal of the edge from corners[index] to corners[index+1], rotated by the shape's angle.
+	v2 get_baked_normal(Shape *shape, int index) {
+		update_rotation(shape);
+		return get_transform(shape).to_world_direction(shape->normals[index]);
+	}
+	
+	// Returns the corner furthest in the direction. The corner count is a template
+	// parameter so that the compiler can unroll and vectorise the loop.
+	template <int CORNER_COUNT>
+	v2 find_furthest_corner(const v2 *corners, v2 direction) {
+		v2 best_corner;
+		double best_dot = -INFINITY;
+		
+		for (int c = 0; c < CORNER_COUNT; c++) {
+			double new_dot = dot(corners[c], direction);
+			
+			if (new_dot > best_dot) {
+				best_corner = corners[c];
+				best_dot = new_dot;
+			}
+		}
+		
+		return best_corner;
+	}
+	
+	v2 find_furthest_corner(const v2 *corners, int corner_count, v2 direction) {
+		switch (corner_count) {
+			case 2: return find_furthest_corner<2>(corners, direction);
+			case 3: return find_furthest_corner<3>(corners, direction);
+			case 4: return find_furthest_corner<4>(corners, direction);
+			case 5: return find_furthest_corner<5>(corners, direction);
+			case 6: return find_furthest_corner<6>(corners, direction);
+			case 7: return find_furthest_corner<7>(corners, direction);
+			case 8: return find_furthest_corner<8>(corners, direction);
+		}
+		
+		v2 best_corner;
+		double best_dot = -INFINITY;
+		
+		for (int c = 0; c < corner_count; c++) {
+			double new_dot = dot(corners[c], direction);
+			
+			if (new_dot > best_dot) {
+				best_corner = corners[c];
+				best_dot = new_dot;
+			}
+		}
+		
+		return best_corner;
+	}
+	
+	// Returns the corner of the shape's core (i.e. ignoring its rounding) furthest in the direction,
+	// both in the shape's own space.
+	v2 get_local_core_corner(const Shape *shape, v2 local_direction) {
+		if (shape->is_circle || shape->corner_count == 0) return ORIGIN;
+		
+		if (shape->is_box) {
+			return v2(
+				local_direction.x >= 0 ? shape->half_size.x : -shape->half_size.x,
+				local_direction.y >= 0 ? shape->half_size.y : -shape->half_size.y);
+		}
+		
+		return find_furthest_corner(shape->corners, shape->corner_count, local_direction);
+	}
+	
+	// The same as get_local_core_corner(), but in world space. This costs two rotations, however many
+	// corners the shape has.
+	v2 get_baked_core_corner(const Shape *shape, v2 direction) {
+		if (shape->is_circle || shape->corner_count == 0) return shape->pos;
+		
+		Transform transform = get_transform(shape);
+		return transform.to_world(get_local_core_corner(shape, transform.to_local_direction(direction)));
+	}
+	
+	v2 get_minkowski_diffed_corner(const Shape *shape, const Shape *other_shape, v2 direction) {
+		assert(!direction.is_0());
+		RW_GJK_COUNT(support_calls);
+		
+		v2 baked_corner = get_baked_core_corner(shape, direction);
+		v2 other_baked_corner = get_baked_core_corner(other_shape, -direction);
+		v2 diffed_corner = baked_corner - other_baked_corner;
+		
+		// inflate the core corner by both shapes' rounding.
+		double rounding = shape->rounding + other_shape->rounding;
+		if (rounding > 0) diffed_corner = diffed_corner + direction.normalised_or_0() * rounding;
+		
+		return diffed_corner;
+	}
+	
+	/*
+	Adds b to an expansion, i.e. a sum of doubles that don't overlap bit-wise, in order of increasing
+	magnitude. The result is exact, and its sign is the sign of its last (largest) component. This is
+	Shewchuk's Grow-Expansion with zeroes removed.
+	*/
+	void grow_expansion(double *expansion, int *length, double b) {
+		int new_length = 0;
+		for (int e = 0; e < *length; e++) {
+			double sum = b + expansion[e];
+			double b_virtual = sum - b;
+			double error = (b - (sum - b_virtual)) + (expansion[e] - b_virtual);
+			if (error != 0) expansion[new_length++] = error;
+			b = sum;
+		}
+		if (b != 0) expansion[new_length++] = b;
+		*length = new_length;
+	}
+	
+	/*
+	Returns the sign of (a1 - a0)*(b1 - b0) + (c1 - c0)*(d1 - d0), which every side test boils down to.
+	Plain doubles almost always get it right, and Shewchuk's error bound says when they might not. Only
+	then is it worked out again exactly, by splitting each difference and product into a rounded part
+	and its rounding error, and summing all of them as an expansion.
+	*/
+	int get_sign_of_product_sum(double a1, double a0, double b1, double b0, double c1, double c0, double d1, double d0) {
+		double a = a1 - a0, b = b1 - b0, c = c1 - c0, d = d1 - d0;
+		double ab = a*b;
+		double cd = c*d;
+		double sum = ab + cd;
+		
+		const double EPSILON = DBL_EPSILON / 2; // the largest relative rounding error of one operation.
+		const double ERROR_BOUND = (3 + 16*EPSILON) * EPSILON;
+		double error_bound = ERROR_BOUND * (fabs(ab) + fabs(cd));
+		if (sum > error_bound) return 1;
+		if (sum < -error_bound) return -1;
+		
+		RW_GJK_COUNT(exact_fallbacks);
+		
+		// the rounding errors of the differences, so that e.g. a + a_error == a1 - a0 exactly.
+		auto get_difference_error = [](double high, double low, double difference) {
+			double low_virtual = high - difference;
+			double high_virtual = difference + low_virtual;
+			return (high - high_virtual) + (low_virtual - low);
+		};
+		double a_error = get_difference_error(a1, a0, a);
+		double b_error = get_difference_error(b1, b0, b);
+		double c_error = get_difference_error(c1, c0, c);
+		double d_error = get_difference_error(d1, d0, d);
+		
+		double expansion[16];
+		int length = 0;
+		auto add_product = [&](double x, double y) {
+			double rounded = x*y;
+			grow_expansion(expansion, &length, rounded);
+			grow_expansion(expansion, &length, fma(x, y, -rounded)); // fma() rounds once, so this is exact.
+		};
+		add_product(a, b);
+		add_product(a, b_error);
+		add_product(a_error, b);
+		add_product(a_error, b_error);
+		add_product(c, d);
+		add_product(c, d_error);
+		add_product(c_error, d);
+		add_product(c_error, d_error);
+		
+		return length == 0 ? 0 : expansion[length-1] > 0 ? 1 : -1;
+	}
+	
+	// 1 if c is anticlockwise of the line from a to b, -1 if it's clockwise, or 0 if it's exactly on it.
+	int get_orientation(v2 a, v2 b, v2 c) {
+		// cross(b - a, c - a)
+		return get_sign_of_product_sum(b.x, a.x, c.y, a.y, a.y, b.y, c.x, a.x);
+	}
+	
+	// The exact sign of dot(a - from, b - from).
+	int get_sign_of_dot(v2 from, v2 a, v2 b) {
+		return get_sign_of_product_sum(a.x, from.x, b.x, from.x, a.y, from.y, b.y, from.y);
+	}
+	
+	/*
+	GJK's search directions only need to point the right way, so they are never normalised. This
+	avoids a square root and a divide for every one of them.
+	*/
+	bool improve_2_simplex(vector<v2> &simplex, v2 &search_direction, double line_thickness) {
+		/*
+		Find which simplex component the origin is closest
+		to, or whether it is on the simplex line itself.
+		*/
+		int past_start = get_sign_of_dot(simplex[0], ORIGIN, simplex[1]);
+		int before_end = get_sign_of_dot(simplex[1], ORIGIN, simplex[0]);
+		
+		if (past_start >= 0 && before_end >= 0) {
+			v2 line = simplex[1] - simplex[0];
+			
+			// this is the origin's distance from the line, multiplied by the line's length.
+			double scaled_origin_distance_from_line = cross(line, ORIGIN - simplex[0]);
+			int origin_side = get_orientation(simplex[0], simplex[1], ORIGIN);
+			
+			if (origin_side == 0 || scaled_origin_distance_from_line*scaled_origin_distance_from_line
+				<= line_thickness*line_thickness * dot(line, line)) {
+				RW_GJK_COUNT(degenerate_cases);
+				return true; // The simplex contains the origin.
+			} else {
+				// The simplex is correct. Search on the side of the 2-simplex that contains the origin.
+				search_direction = origin_side > 0 ? v2(-line.y, line.x) : v2(line.y, -line.x);
+			}
+		} else if (past_start < 0) {
+			simplex = {simplex[0]}; // The origin is closest to point 0.
+			search_direction = ORIGIN - simplex[0];
+		} else {
+			assert(before_end < 0);
+			simplex = {simplex[1]}; // The origin is closest to point 1.
+			search_direction = ORIGIN - simplex[1];
+		}
+		
+		return false;
+	}
+	
+	// returns true when the simplex contains the origin.
+	bool improve_simplex(vector<v2> &simplex, v2 &search_direction, double line_thickness) {
+		assert(simplex.size() <= 3);
+		
+		if (simplex.size() == 3) {
+			// the origin is outside an edge when it's on the opposite side of it to the triangle's
+			// third corner. A flat triangle has no outside, as before.
+			int winding = get_orientation(simplex[0], simplex[1], simplex[2]);
+			auto is_outside_edge = [&](v2 start, v2 end) {
+				return winding != 0 && get_orientation(start, end, ORIGIN) == -winding;
+			};
+			
+			// find which side of the triangle the origin is on, or if it's inside it.
+			if (is_outside_edge(simplex[0], simplex[1])) {
+				simplex = {simplex[0], simplex[1]};
+			} else if (is_outside_edge(simplex[1], simplex[2])) {
+				simplex = {simplex[1], simplex[2]};
+			} else if (is_outside_edge(simplex[2], simplex[0])) {
+				simplex = {simplex[2], simplex[0]};
+			} else {
+				return true; // the origin is inside the simplex.
+			}
+		}
+		
+		return improve_2_simplex(simplex, search_direction, line_thickness);
+	}
+	
+	/*
+	get_overlap_amount() uses the separating axis theorem instead of GJK and EPA for pairs of sharp
+	polygons with up to this many corners, because it's faster for them. Tuned with benchmarks.cpp in a
+	Release build, where the separating axis test stays ahead until about 12 corners. Define it as 0 to
+	always use GJK and EPA. shapes_are_overlapping() always uses GJK, since GJK usually finds a yes/no
+	answer in fewer steps than it takes the separating axis test to check every axis.
+	*/
+	#ifndef RW_GJK_SAT_MAX_CORNERS
+		#define RW_GJK_SAT_MAX_CORNERS 8
+	#endif
+	const int SAT_MAX_CORNERS = RW_GJK_SAT_MAX_CORNERS;
+	const int SAT_CORNER_CAPACITY = 16; // SAT_MAX_CORNERS can't be raised above this.
+	static_assert(SAT_MAX_CORNERS <= SAT_CORNER_CAPACITY, "the separating axis test can't handle that many corners");
+	
+	// Returns true if both shapes are sharp polygons with at most max_corners corners.
+	bool are_sharp_polygons(Shape *shape_a, Shape *shape_b, int max_corners) {
+		// segments only have the axes across them, and not along them, so they're left to GJK.
+		auto is_sharp_polygon = [&](Shape *shape) {
+			return !shape->is_circle && shape->rounding == 0 && shape->corner_count >= 3 && shape->corner_count <= max_corners;
+		};
+		
+		return is_sharp_polygon(shape_a) && is_sharp_polygon(shape_b);
+	}
+	
+	// Returns true if the shapes are small enough to be tested faster with the separating axis theorem.
+	bool sat_is_preferred(Shape *shape_a, Shape *shape_b) {
+		return are_sharp_polygons(shape_a, shape_b, SAT_MAX_CORNERS);
+	}
+	
+	/*
+	Uses the separating axis theorem to find the edge normal of either shape along which the shapes
+	overlap the least. Returns how much they overlap along it, which is negative if they're separated,
+	and sets push_out to the direction that shape_a would have to move in to resolve the overlap.
+	Returns early as soon as a separating axis is found, so push_out is only meaningful for overlaps.
+	*/
+	double get_sat_overlap(Shape *shape_a, Shape *shape_b, double line_thickness, v2 *push_out) {
+		RW_GJK_TRACE_SPAN("separating axis test");
+		assert(shape_a->corner_count <= SAT_CORNER_CAPACITY && shape_b->corner_count <= SAT_CORNER_CAPACITY);
+		
+		/*
+		Everything happens in a's space, so a's corners and normals are used as they are, and only b's
+		are rotated, once each. Only the final push is rotated back into world space.
+		*/
+		Transform transform_a = get_transform(shape_a);
+		Transform transform_b = get_transform(shape_b);
+		double relative_cos = transform_a.angle_cos * transform_b.angle_cos + transform_a.angle_sin * transform_b.angle_sin;
+		double relative_sin = transform_a.angle_cos * transform_b.angle_sin - transform_a.angle_sin * transform_b.angle_cos;
+		v2 relative_pos = transform_a.to_local_direction(shape_b->pos - shape_a->pos);
+		
+		v2 local_corners_b[SAT_CORNER_CAPACITY];
+		v2 local_normals_b[SAT_CORNER_CAPACITY];
+		for (int c = 0; c < shape_b->corner_count; c++) {
+			local_corners_b[c] = relative_pos + shape_b->corners[c].rotated(relative_cos, relative_sin);
+			local_normals_b[c] = shape_b->normals[c].rotated(relative_cos, relative_sin);
+		}
+		
+		auto get_extent = [](const v2 *corners, int corner_count, v2 axis, double *min_out, double *max_out) {
+			*min_out = INFINITY;
+			*max_out = -INFINITY;
+			for (int c = 0; c < corner_count; c++) {
+				// min() and max() rather than fmin() and fmax(), which are calls that handle NANs.
+				double distance = dot(corners[c], axis);
+				*min_out = min(*min_out, distance);
+				*max_out = max(*max_out, distance);
+			}
+		};
+		
+		double smallest_overlap = INFINITY;
+		v2 local_push;
+		
+		// returns false as soon as one of the axes separates the shapes.
+		auto test_axes = [&](const v2 *axes, int axis_count) {
+			for (int n = 0; n < axis_count; n++) {
+				double min_a, max_a, min_b, max_b;
+				get_extent(shape_a->corners, shape_a->corner_count, axes[n], &min_a, &max_a);
+				get_extent(local_corners_b, shape_b->corner_count, axes[n], &min_b, &max_b);
+				
+				// a can resolve the overlap by moving back along the axis, or forward along it.
+				double backward_overlap = max_a - min_b;
+				double forward_overlap = max_b - min_a;
+				double overlap = fmin(backward_overlap, forward_overlap);
+				
+				if (overlap < smallest_overlap) {
+					smallest_overlap = overlap;
+					local_push = backward_overlap < forward_overlap ? -axes[n] : axes[n];
+				}
+				
+				if (smallest_overlap < -line_thickness) return false;
+			}
+			return true;
+		};
+		
+		if (!test_axes(shape_a->normals, shape_a->corner_count) || !test_axes(local_normals_b, shape_b->corner_count)) {
+			return smallest_overlap; // found a separating axis.
+		}
+		
+		*push_out = transform_a.to_world_direction(local_push);
+		return smallest_overlap;
+	}
+	
+	// Returns true if both shapes are boxes without rounding, so get_box_overlap() can be used.
+	bool are_sharp_boxes(Shape *shape_a, Shape *shape_b) {
+		return shape_a->is_box && shape_b->is_box && shape_a->rounding == 0 && shape_b->rounding == 0;
+	}
+	
+	/*
+	Like get_sat_overlap(), but for two boxes. Each box only has two distinct axes, and its extent along
+	any axis comes straight from its half size, so no corners need to be visited at all.
+	*/
+	double get_box_overlap(Shape *box_a, Shape *box_b, double line_thickness, v2 *push_out) {
+		RW_GJK_TRACE_SPAN("box separating axis test");
+		Transform transform_a = get_transform(box_a);
+		Transform transform_b = get_transform(box_b);
+		v2 axes_a[2] = { transform_a.to_world_direction(v2(1, 0)), transform_a.to_world_direction(v2(0, 1)) };
+		v2 axes_b[2] = { transform_b.to_world_direction(v2(1, 0)), transform_b.to_world_direction(v2(0, 1)) };
+		v2 centre_offset = box_a->pos - box_b->pos;
+		
+		double smallest_overlap = INFINITY;
+		
+		for (v2 axis : {axes_a[0], axes_a[1], axes_b[0], axes_b[1]}) {
+			double extent_a = box_a->half_size.x * fabs(dot(axes_a[0], axis)) + box_a->half_size.y * fabs(dot(axes_a[1], axis));
+			double extent_b = box_b->half_size.x * fabs(dot(axes_b[0], axis)) + box_b->half_size.y * fabs(dot(axes_b[1], axis));
+			double centre_distance = dot(centre_offset, axis);
+			double overlap = extent_a + extent_b - fabs(centre_distance);
+			
+			if (overlap < smallest_overlap) {
+				smallest_overlap = overlap;
+				*push_out = centre_distance >= 0 ? axis : -axis;
+			}
+			
+			if (smallest_overlap < -line_thickness) return smallest_overlap; // found a separating axis.
+		}
+		
+		return smallest_overlap;
+	}
+	
+	/*
+	Scratch memory for the temporary simplices and polytopes of a query. Its vectors are only ever
+	cleared, never freed, so once they have grown to fit the biggest query, no more queries allocate.
+	Each thread has its own by default, but callers can pass in their own instead, e.g. to free the
+	memory when they're done with it. A workspace must not be used by two queries at the same time.
+	*/
+	struct Workspace {
+		vector<v2> simplex; // used by GJK, and then by EPA as its polytope.
+	};
+	
+	thread_local Workspace thread_workspace;
+	
+	/*
+	The boolean variant of GJK. Returns true if the shapes overlap, and leaves the final simplex in
+	simplex_out for EPA to start from. Otherwise, if separating_axis_out isn't null, it's set to a
+	direction along which the minkowski difference lies entirely behind the origin.
+	*/
+	bool simplex_contains_origin(
+		Shape *shape_a, Shape *shape_b, double line_thickness, vector<v2> *simplex_out, Status *status_out,
+		v2 *separating_axis_out = nullptr) {
+		
+		RW_GJK_TRACE_SPAN("GJK");
+		vector<v2> &simplex = *simplex_out;
+		simplex.clear();
+		
+		// setting the initial direction like this maximises the
+		// chance of the simplex covering the origin early. TODO: does it actually tho?
+		v2 search_direction = (shape_b->pos - shape_a->pos).right_normal_or_0();
+		if (search_direction.is_0()) search_direction = v2(1, 0);
+		
+		RW_GJK_COUNT_ALLOCATION_IF_FULL(simplex);
+		simplex.push_back(get_minkowski_diffed_corner(shape_a, shape_b, search_direction));
+		search_direction = ORIGIN - simplex[0]; // search toward the origin
+		
+		if (search_direction.is_0()) {
+			// the first corner is exactly on the origin, so the shapes are just touching.
+			RW_GJK_COUNT(degenerate_cases);
+			*status_out = STATUS_DEGENERATE;
+			return true;
+		}
+		
+		for (int iteration = 0; ; iteration++) {
+			if (iteration == max_gjk_iterations) {
+				// the origin hasn't been ruled out yet, so assume the shapes overlap.
+				*status_out = STATUS_HIT_ITERATION_CAP;
+				return true;
+			}
+			
+			RW_GJK_COUNT(gjk_iterations);
+			RW_GJK_COUNT_ALLOCATION_IF_FULL(simplex);
+			simplex.push_back(get_minkowski_diffed_corner(shape_a, shape_b, search_direction));
+			
+			// stop if the new corner is no more than a line thickness past the origin. The search
+			// direction isn't normalised, so compare the squares to avoid a square root.
+			double new_corner_distance = dot(simplex.back(), search_direction);
+			if (new_corner_distance <= 0 || new_corner_distance*new_corner_distance
+				<= line_thickness*line_thickness * dot(search_direction, search_direction)) {
+				*status_out = STATUS_CONVERGED;
+				if (separating_axis_out != nullptr) *separating_axis_out = search_direction;
+				return false;
+			}
+			
+			if (improve_simplex(simplex, search_direction, line_thickness)) {
+				// a 2-simplex only contains the origin when the origin is on its line.
+				*status_out = simplex.size() == 3 ? STATUS_CONVERGED : STATUS_DEGENERATE;
+				return true;
+			}
+		}
+	}
+	
+	bool shapes_are_overlapping(
+		Shape *shape_a, Shape *shape_b, Status *status_out = nullptr, Workspace *workspace = nullptr) {
+		
+		Status status;
+		if (status_out == nullptr) status_out = &status;
+		if (workspace == nullptr) workspace = &thread_workspace;
+		
+		update_rotation(shape_a);
+		update_rotation(shape_b);
+		
+		double line_thickness = get_line_thickness(shape_a, shape_b);
+		
+		if (are_sharp_boxes(shape_a, shape_b)) {
+			v2 push;
+			double overlap = get_box_overlap(shape_a, shape_b, line_thickness, &push);
+			
+			// like GJK, treat shapes that are only touching as overlapping.
+			*status_out = fabs(overlap) <= line_thickness ? STATUS_DEGENERATE : STATUS_CONVERGED;
+			return overlap >= -line_thickness;
+		}
+		
+		return simplex_contains_origin(shape_a, shape_b, line_thickness, &workspace->simplex, status_out);
+	}
+	
+	// Which corners of a line are needed to describe the point on it closest to the origin.
+	enum Line_part {
+		LINE_START,
+		LINE_END,
+		LINE_INTERIOR,
+	};
+	
+	v2 get_closest_point_on_line(v2 start, v2 end, Line_part *part_out) {
+		v2 line_vector = end - start;
+		if (line_vector.is_0()) {
+			*part_out = LINE_START;
+			return start;
+		}
+		
+		double t = dot(ORIGIN - start, line_vector) / dot(line_vector, line_vector);
+		if (t <= 0) {
+			*part_out = LINE_START;
+			return start;
+		} else if (t >= 1) {
+			*part_out = LINE_END;
+			return end;
+		} else {
+			*part_out = LINE_INTERIOR;
+			return start + line_vector * t;
+		}
+	}
+	
+	// Returns the point on the simplex closest to the origin, and reduces the simplex in place
+	// to the corners that are needed to describe that point.
+	v2 get_closest_point_on_simplex(vector<v2> &simplex) {
+		assert(simplex.size() >= 1 && simplex.size() <= 3);
+		
+		if (simplex.size() == 1) return simplex[0];
+		
+		int best_line_start = 0;
+		Line_part best_part;
+		v2 best_point;
+		
+		if (simplex.size() == 2) {
+			best_point = get_closest_point_on_line(simplex[0], simplex[1], &best_part);
+		} else {
+			// check whether the origin is inside the triangle, i.e. on the same side of all three lines.
+			int ab_side = get_orientation(simplex[0], simplex[1], ORIGIN);
+			int bc_side = get_orientation(simplex[1], simplex[2], ORIGIN);
+			int ca_side = get_orientation(simplex[2], simplex[0], ORIGIN);
+			if ((ab_side >= 0 && bc_side >= 0 && ca_side >= 0) || (ab_side <= 0 && bc_side <= 0 && ca_side <= 0)) {
+				return ORIGIN;
+			}
+			
+			// otherwise the closest point is on the closest of the three lines.
+			for (int s = 0; s < 3; s++) {
+				Line_part part;
+				v2 point = get_closest_point_on_line(simplex[s], simplex[(s+1) % 3], &part);
+				
+				if (s == 0 || dot(point, point) < dot(best_point, best_point)) {
+					best_line_start = s;
+					best_part = part;
+					best_point = point;
+				}
+			}
+		}
+		
+		// the simplex never grows here, so this never allocates.
+		v2 start = simplex[best_line_start];
+		v2 end = simplex[(best_line_start+1) % simplex.size()];
+		simplex.clear();
+		if (best_part != LINE_END) simplex.push_back(start);
+		if (best_part != LINE_START) simplex.push_back(end);
+		return best_point;
+	}
+	
+	/*
+	Returns the vector between the closest points of the shapes' cores (i.e. ignoring their rounding),
+	pointing from shape_b's core toward shape_a's core, or (0, 0) when the cores overlap. This is the
+	distance variant of GJK.
+	*/
+	v2 get_core_separation(
+		Shape *shape_a, Shape *shape_b, double line_thickness, vector<v2> *simplex_out, Status *status_out) {
+		
+		RW_GJK_TRACE_SPAN("GJK distance");
+		auto get_core_diffed_corner = [&](v2 direction) {
+			RW_GJK_COUNT(support_calls);
+			return get_baked_core_corner(shape_a, direction) - get_baked_core_corner(shape_b, -direction);
+		};
+		
+		v2 search_direction = shape_a->pos - shape_b->pos;
+		if (search_direction.is_0()) search_direction = v2(1, 0);
+		
+		vector<v2> &simplex = *simplex_out;
+		simplex.clear();
+		RW_GJK_COUNT_ALLOCATION_IF_FULL(simplex);
+		simplex.push_back(get_core_diffed_corner(-search_direction));
+		v2 closest_point = simplex[0];
+		*status_out = STATUS_CONVERGED;
+		
+		for (int iteration = 0; ; iteration++) {
+			if (iteration == max_gjk_iterations) {
+				// the closest point so far is never closer than the true closest point, so it's a safe answer.
+				*status_out = STATUS_HIT_ITERATION_CAP;
+				return closest_point;
+			}
+			
+			RW_GJK_COUNT(gjk_iterations);
+			double closest_distance = closest_point.length();
+			if (closest_distance <= line_thickness) {
+				RW_GJK_COUNT(degenerate_cases);
+				return ORIGIN;
+			}
+			
+			v2 new_corner = get_core_diffed_corner(-closest_point);
+			
+			// stop when the new corner brings the simplex no closer to the origin.
+			double improvement = dot(closest_point, closest_point - new_corner) / closest_distance;
+			if (improvement <= line_thickness) return closest_point;
+			
+			RW_GJK_COUNT_ALLOCATION_IF_FULL(simplex);
+			simplex.push_back(new_corner);
+			v2 new_closest_point = get_closest_point_on_simplex(simplex);
+			if (simplex.size() == 3) return ORIGIN; // the simplex contains the origin.
+			if (dot(new_closest_point, new_closest_point) >= closest_distance*closest_distance) return closest_point;
+			
+			closest_point = new_closest_point;
+		}
+	}
+	
+	/*
+	The separating axis half of get_overlap_amount(), for two sharp boxes, or two sharp polygons with up
+	to SAT_CORNER_CAPACITY corners each. get_overlap_amount() already picks it whenever it's faster.
+	*/
+	v2 get_sat_overlap_amount(Shape *shape_a, Shape *shape_b, Status *status_out = nullptr) {
+		assert(are_sharp_boxes(shape_a, shape_b) || are_sharp_polygons(shape_a, shape_b, SAT_CORNER_CAPACITY));
+		
+		Status status;
+		if (status_out == nullptr) status_out = &status;
+		
+		update_rotation(shape_a);
+		update_rotation(shape_b);
+		
+		double line_thickness = get_line_thickness(shape_a, shape_b);
+		v2 push;
+		double overlap = are_sharp_boxes(shape_a, shape_b)
+			? get_box_overlap(shape_a, shape_b, line_thickness, &push)
+			: get_sat_overlap(shape_a, shape_b, line_thickness, &push);
+		if (overlap < -line_thickness) {
+			*status_out = STATUS_CONVERGED;
+			return v2(0, 0); // no overlap.
+		}
+		
+		// like GJK, treat shapes that are only touching as overlapping.
+		*status_out = fabs(overlap) <= line_thickness ? STATUS_DEGENERATE : STATUS_CONVERGED;
+		return push * -(fmax(overlap, 0) + line_thickness);
+	}
+	
+	// The GJK and EPA half of get_overlap_amount(), which works for any pair of shapes.
+	v2 get_epa_overlap_amount(
+		Shape *shape_a, Shape *shape_b, Status *status_out = nullptr, Workspace *workspace = nullptr) {
+		
+		Status status;
+		if (status_out == nullptr) status_out = &status;
+		if (workspace == nullptr) workspace = &thread_workspace;
+		
+		update_rotation(shape_a);
+		update_rotation(shape_b);
+		
+		double line_thickness = get_line_thickness(shape_a, shape_b);
+		
+		/*
+		If the shapes are rounded, check their cores first. If the cores are separated, the overlap
+		comes straight from the core distance and the rounding, and EPA isn't needed at all.
+		*/
+		double rounding = shape_a->rounding + shape_b->rounding;
+		if (rounding > 0) {
+			v2 core_separation = get_core_separation(shape_a, shape_b, line_thickness, &workspace->simplex, status_out);
+			
+			if (!core_separation.is_0()) {
+				double core_distance = core_separation.length();
+				if (core_distance >= rounding) return v2(0, 0); // no overlap.
+				
+				return core_separation.normalised_or_0() * -(rounding - core_distance + line_thickness);
+			}
+		}
+		
+		// EPA grows GJK's final simplex into a polytope in place.
+		vector<v2> &simplex = workspace->simplex;
+		
+		if (!simplex_contains_origin(shape_a, shape_b, line_thickness, &simplex, status_out)) {
+			return v2(0, 0); // no overlap, therefore no overlap amount.
+		}
+		
+		if (simplex.size() < 3) {
+			RW_GJK_COUNT(degenerate_cases);
+			if (*status_out == STATUS_CONVERGED) *status_out = STATUS_DEGENERATE;
+			v2 pos_vector = (shape_b->pos - shape_a->pos).normalised_or_0();
+			if (pos_vector.is_0()) pos_vector.x = 1;
+			return pos_vector * line_thickness;
+		}
+		
+		RW_GJK_TRACE_SPAN("EPA");
+		
+		// the point on a simplex line that is closest to the origin is the overlap amount.
+		auto get_overlap_amount_from_line = [&](int line_start_index, int line_end_index) {
+			v2 simplex_line_unit = (simplex[line_end_index] - simplex[line_start_index]).normalised_or_0();
+			double len = dot(simplex_line_unit, ORIGIN - simplex[line_start_index]);
+			v2 point_of_overlap = simplex[line_start_index] + simplex_line_unit * len;
+			
+			v2 overlap_vector = point_of_overlap - ORIGIN;
+			v2 overlap_direction = overlap_vector.normalised_or_0();
+			if (overlap_direction.is_0()) overlap_direction = simplex_line_unit.right_normal_or_0();
+			return overlap_direction * (overlap_vector.length() + line_thickness);
+		};
+		
+		for (int iteration = 0; ; iteration++) {
+			RW_GJK_COUNT(epa_iterations);
+			const double CORNER_SIMILARITY_TOLERANCE = line_thickness;
+			
+			// get simplex line closest to origin.
+			double closest_line_distance = INFINITY;
+			int line_start_index = -1;
+			for (int s0 = 0; s0 < simplex.size(); s0++) {
+				int s1 = (s0+1) % simplex.size();
+				v2 simplex_line_normal = (simplex[s1] - simplex[s0]).right_normal_or_0();
+				
+				double line_distance = fabs(dot(simplex_line_normal, ORIGIN - simplex[s0]));
+				
+				if (line_distance < closest_line_distance) {
+					line_start_index = s0;
+					closest_line_distance = line_distance;
+				}
+			}
+			
+			// get the outer normal of that line and get the minkowski diffed corner in that direction.
+			int line_end_index = (line_start_index+1) % simplex.size();
 			v2 simplex_line = simplex[line_end_index] - simplex[line_start_index];
 			v2 outer_normal = simplex_line.normal_in_direction_or_0(simplex[line_start_index] - ORIGIN);
+			
+			if (iteration == max_epa_iterations) {
+				*status_out = STATUS_HIT_ITERATION_CAP;
+				return get_overlap_amount_from_line(line_start_index, line_end_index);
+			} else if (outer_normal.is_0()) {
+				// the origin is on the line, so there's no way to tell which side is outward.
+				RW_GJK_COUNT(degenerate_cases);
+				*status_out = STATUS_DEGENERATE;
+				return get_overlap_amount_from_line(line_start_index, line_end_index);
+			}
+			
 			v2 new_corner = get_minkowski_diffed_corner(shape_a, shape_b, outer_normal);
 			
-			// check if the new corner is almost identical to one of the points that made the simplex.
-			for (auto &simplex_corner : simplex) {
-				if (simplex_corner.distance(new_corner) <= CORNER_SIMILARITY_TOLERANCE) {
-					// the new corner is almost identical to an existing one, so we've finished expanding the simplex.
+			// check if the new corner is almost identical to one of the points that made the simplex.
+			for (auto &simplex_corner : simplex) {
+				if (simplex_corner.distance(new_corner) <= CORNER_SIMILARITY_TOLERANCE) {
+					// the new corner is almost identical to an existing one, so we've finished expanding the simplex.
+					return get_overlap_amount_from_line(line_start_index, line_end_index);
+				}
+			}
+			
+			// else add the new corner to the simplex, turning the existing line into two.
+			RW_GJK_COUNT_ALLOCATION_IF_FULL(simplex);
+			simplex.insert(simplex.begin()+line_end_index, new_corner);
+			assert(!contains_duplicates(simplex));
+		} // end while
+	}
+	
+	// Returns the amount that a is overlapping b.
+	// Negating this amount from a->pos will resolve the overlap.
+	v2 get_overlap_amount(
+		Shape *shape_a, Shape *shape_b, Status *status_out = nullptr, Workspace *workspace = nullptr) {
+		
+		if (are_sharp_boxes(shape_a, shape_b) || sat_is_preferred(shape_a, shape_b)) {
+			return get_sat_overlap_amount(shape_a, shape_b, status_out);
+		}
+		return get_epa_overlap_amount(shape_a, shape_b, status_out, workspace);
+	}
+	
+	/*
+	Shapes in a World are referred to by handles, which stay the same however many other shapes are
+	added or removed. The low 32 bits are the shape's slot and the high 32 are a generation count, so an
+	old handle to a removed shape won't refer to whichever shape reuses its slot. A slot would have to
+	be reused 2^32 times for the count to come back around.
+	*/
+	typedef uint64_t Shape_handle;
+	const Shape_handle NO_SHAPE = UINT64_MAX;
+	
+	enum Overlap_event_type {
+		OVERLAP_BEGIN, // the shapes started overlapping this step.
+		OVERLAP_PERSIST, // the shapes were already overlapping, and still are.
+		OVERLAP_END, // the shapes stopped overlapping, or one of them was removed.
+	};
+	
+	struct Overlap_event {
+		Overlap_event_type type;
+		Shape_handle shape_a, shape_b;
+	};
+	
+	// An axis-aligned bounding box.
+	struct Aabb {
+		v2 min, max;
+	};
+	
+	bool aabbs_overlap(const Aabb &a, const Aabb &b) {
+		return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+	}
+	
+	bool aabb_contains(const Aabb &outer, const Aabb &inner) {
+		return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y
+			&& inner.max.x <= outer.max.x && inner.max.y <= outer.max.y;
+	}
+	
+	Aabb merge_aabbs(const Aabb &a, const Aabb &b) {
+		return { v2(fmin(a.min.x, b.min.x), fmin(a.min.y, b.min.y)), v2(fmax(a.max.x, b.max.x), fmax(a.max.y, b.max.y)) };
+	}
+	
+	double get_aabb_perimeter(const Aabb &aabb) {
+		return 2 * ((aabb.max.x - aabb.min.x) + (aabb.max.y - aabb.min.y));
+	}
+	
+	Aabb get_aabb(const Shape &shape, double margin = 0) {
+		v2 extent = v2(shape.radius + margin, shape.radius + margin);
+		return { shape.pos - extent, shape.pos + extent };
+	}
+	
+	/*
+	A bounding volume hierarchy over shapes that don't move. It's built in one go and never refit, and
+	its nodes are packed depth first into one array: a node's first child comes straight after it, so
+	only the second child's index is stored.
+	*/
+	class Static_bvh {
+	public:
+		struct Item {
+			Aabb aabb;
+			int id;
+		};
+		
+		// Rebuilds the whole tree. The items are reordered.
+		void build(vector<Item> &items) {
+			nodes.clear();
+			nodes.reserve(items.size() * 2);
+			if (!items.empty()) build_node(items.data(), items.size());
+		}
+		
+		// Calls found(id) for every item whose bounds overlap the aabb.
+		template <typename Found>
+		void query(const Aabb &aabb, Found found) const {
+			if (nodes.empty()) return;
+			
+			// each split halves the items, so the stack never holds more than 2 + log2(item count) nodes.
+			const int STACK_CAPACITY = 64;
+			int stack[STACK_CAPACITY];
+			int stack_size = 0;
+			stack[stack_size++] = 0;
+			while (stack_size > 0) {
+				int node_index = stack[--stack_size];
+				const Node &node = nodes[node_index];
+				if (!aabbs_overlap(node.aabb, aabb)) continue;
+				
+				if (node.id >= 0) {
+					found(node.id);
+				} else {
+					assert(stack_size + 2 <= STACK_CAPACITY);
+					stack[stack_size++] = node.second_child;
+					stack[stack_size++] = node_index + 1;
+				}
+			}
+		}
+		
+	private:
+		struct Node {
+			Aabb aabb;
+			int second_child;
+			int id; // -1 for internal nodes.
+		};
+		
+		vector<Node> nodes;
+		
+		// Splits the items at the median of the longer axis, which keeps the tree balanced, and under 64 deep.
+		int build_node(Item *items, int item_count) {
+			int node_index = nodes.size();
+			nodes.push_back(Node());
+			
+			Aabb aabb = items[0].aabb;
+			for (int i = 1; i < item_count; i++) aabb = merge_aabbs(aabb, items[i].aabb);
+			nodes[node_index].aabb = aabb;
+			
+			if (item_count == 1) {
+				nodes[node_index].id = items[0].id;
+				return node_index;
+			}
+			
+			bool split_on_x = aabb.max.x - aabb.min.x > aabb.max.y - aabb.min.y;
+			int half_count = item_count / 2;
+			/*
+			Ties are broken by id, so the order is total and each half gets the same items whichever
+			standard library sorts them. Otherwise the shape of the tree, and the order that queries find
+			things in, could differ between platforms.
+			*/
+			nth_element(items, items + half_count, items + item_count, [&](const Item &a, const Item &b) {
+				double centre_a = split_on_x ? a.aabb.min.x + a.aabb.max.x : a.aabb.min.y + a.aabb.max.y;
+				double centre_b = split_on_x ? b.aabb.min.x + b.aabb.max.x : b.aabb.min.y + b.aabb.max.y;
+				return centre_a != centre_b ? centre_a < centre_b : a.id < b.id;
+			});
+			
+			build_node(items, half_count);
+			int second_child = build_node(items + half_count, item_count - half_count);
+			nodes[node_index].second_child = second_child;
+			nodes[node_index].id = -1;
+			return node_index;
+		}
+	};
+	
+	/*
+	A bounding volume hierarchy over shapes that move, updated one leaf at a time. Each leaf's bounds
+	are fattened so that small movements stay inside them and don't need the tree to change at all.
+	New leaves go wherever they grow the tree's total perimeter the least, and nodes are rotated on the
+	way back up to keep the tree balanced, as in Box2D. Without the rotations, the first few leaves'
+	parents end up spanning the whole world, and every query visits most of the tree.
+	*/
+	class Dynamic_tree {
+	public:
+		// Returns the new leaf's node index.
+		int insert(const Aabb &aabb, int id) {
+			int leaf = allocate_node();
+			nodes[leaf].aabb = aabb;
+			nodes[leaf].id = id;
+			nodes[leaf].child_a = nodes[leaf].child_b = -1;
+			nodes[leaf].height = 0;
+			
+			if (root == -1) {
+				root = leaf;
+				nodes[leaf].parent = -1;
+				return leaf;
+			}
+			
+			/*
+			Walk down the tree until pairing the leaf with the current node is cheaper than pairing it
+			with either child. Pairing with a node costs the perimeter of their new parent, plus how much
+			every ancestor grows by to fit the leaf in.
+			*/
+			int sibling = root;
+			while (nodes[sibling].child_a != -1) {
+				const Node &node = nodes[sibling];
+				double combined_perimeter = get_aabb_perimeter(merge_aabbs(node.aabb, aabb));
+				double cost_here = 2 * combined_perimeter;
+				double inherited_cost = 2 * (combined_perimeter - get_aabb_perimeter(node.aabb));
+				
+				auto get_descent_cost = [&](int child) {
+					double cost = get_aabb_perimeter(merge_aabbs(nodes[child].aabb, aabb));
+					if (nodes[child].child_a != -1) cost -= get_aabb_perimeter(nodes[child].aabb);
+					return cost + inherited_cost;
+				};
+				double cost_a = get_descent_cost(node.child_a);
+				double cost_b = get_descent_cost(node.child_b);
+				
+				if (cost_here < cost_a && cost_here < cost_b) break;
+				sibling = cost_a <= cost_b ? node.child_a : node.child_b;
+			}
+			
+			// replace the sibling with a new parent of it and the leaf.
+			int old_parent = nodes[sibling].parent;
+			int new_parent = allocate_node();
+			nodes[new_parent].parent = old_parent;
+			nodes[new_parent].child_a = sibling;
+			nodes[new_parent].child_b = leaf;
+			nodes[new_parent].id = -1;
+			nodes[sibling].parent = new_parent;
+			nodes[leaf].parent = new_parent;
+			
+			if (old_parent == -1) root = new_parent;
+			else if (nodes[old_parent].child_a == sibling) nodes[old_parent].child_a = new_parent;
+			else nodes[old_parent].child_b = new_parent;
+			
+			refit_from(new_parent);
+			return leaf;
+		}
+		
+		void remove(int leaf) {
+			int parent = nodes[leaf].parent;
+			free_node(leaf);
+			if (parent == -1) {
+				root = -1;
+				return;
+			}
+			
+			// the leaf's sibling takes its parent's place.
+			int sibling = nodes[parent].child_a == leaf ? nodes[parent].child_b : nodes[parent].child_a;
+			int grandparent = nodes[parent].parent;
+			nodes[sibling].parent = grandparent;
+			free_node(parent);
+			
+			if (grandparent == -1) {
+				root = sibling;
+			} else {
+				if (nodes[grandparent].child_a == parent) nodes[grandparent].child_a = sibling;
+				else nodes[grandparent].child_b = sibling;
+				refit_from(grandparent);
+			}
+		}
+		
+		const Aabb &get_leaf_aabb(int leaf) const {
+			return nodes[leaf].aabb;
+		}
+		
+		// Calls found(id) for every leaf whose bounds overlap the aabb.
+		template <typename Found>
+		void query(const Aabb &aabb, Found found) const {
+			if (root != -1) query_subtree(root, aabb, found);
+		}
+		
+	private:
+		/*
+		The rotations keep the tree shallow in practice, but they don't strictly bound its height. So
+		when a subtree would overflow the fixed stack, it's searched with a fresh stack of its own.
+		*/
+		template <typename Found>
+		void query_subtree(int subtree_root, const Aabb &aabb, Found &found) const {
+			const int STACK_CAPACITY = 64;
+			int stack[STACK_CAPACITY];
+			int stack_size = 0;
+			stack[stack_size++] = subtree_root;
+			while (stack_size > 0) {
+				int node_index = stack[--stack_size];
+				const Node &node = nodes[node_index];
+				if (!aabbs_overlap(node.aabb, aabb)) continue;
+				
+				if (node.child_a == -1) {
+					found(node.id);
+				} else if (stack_size + 2 > STACK_CAPACITY) {
+					query_subtree(node.child_b, aabb, found);
+					stack[stack_size++] = node.child_a;
+				} else {
+					stack[stack_size++] = node.child_a;
+					stack[stack_size++] = node.child_b;
+				}
+			}
+		}
+		
+		struct Node {
+			Aabb aabb;
+			int parent;
+			int child_a, child_b; // -1 for leaves.
+			int height; // 0 for leaves.
+			int id;
+		};
+		
+		vector<Node> nodes;
+		vector<int> free_nodes;
+		int root = -1;
+		
+		int allocate_node() {
+			if (free_nodes.empty()) {
+				nodes.push_back(Node());
+				return nodes.size() - 1;
+			}
+			
+			int node_index = free_nodes.back();
+			free_nodes.pop_back();
+			return node_index;
+		}
+		
+		void free_node(int node_index) {
+			free_nodes.push_back(node_index);
+		}
+		
+		void refit_from(int node_index) {
+			for (; node_index != -1; node_index = nodes[node_index].parent) {
+				node_index = balance(node_index);
+				refit_node(node_index);
+			}
+		}
+		
+		void refit_node(int node_index) {
+			Node &node = nodes[node_index];
+			node.aabb = merge_aabbs(nodes[node.child_a].aabb, nodes[node.child_b].aabb);
+			node.height = 1 + max(nodes[node.child_a].height, nodes[node.child_b].height);
+		}
+		
+		// Points whatever pointed at old_child, its parent or the root, at new_child instead.
+		void replace_child(int parent, int old_child, int new_child) {
+			if (parent == -1) root = new_child;
+			else if (nodes[parent].child_a == old_child) nodes[parent].child_a = new_child;
+			else nodes[parent].child_b = new_child;
+		}
+		
+		/*
+		If one of the node's children is more than one level taller than the other, the taller child is
+		rotated up into the node's place, and the node takes whichever of the taller child's children is
+		shorter. Returns the index of the node that's now in the node's place.
+		*/
+		int balance(int node_index) {
+			Node &node = nodes[node_index];
+			if (node.child_a == -1) return node_index;
+			
+			int height_difference = nodes[node.child_b].height - nodes[node.child_a].height;
+			if (height_difference >= -1 && height_difference <= 1) return node_index;
+			
+			int short_child = height_difference > 1 ? node.child_a : node.child_b;
+			int tall_child = height_difference > 1 ? node.child_b : node.child_a;
+			Node &tall = nodes[tall_child];
+			
+			// the tall child's taller child stays with it, and its shorter child moves down to the node.
+			bool a_is_taller = nodes[tall.child_a].height > nodes[tall.child_b].height;
+			int kept_grandchild = a_is_taller ? tall.child_a : tall.child_b;
+			int moved_grandchild = a_is_taller ? tall.child_b : tall.child_a;
+			
+			replace_child(node.parent, node_index, tall_child);
+			tall.parent = node.parent;
+			tall.child_a = node_index;
+			tall.child_b = kept_grandchild;
+			
+			node.parent = tall_child;
+			node.child_a = short_child;
+			node.child_b = moved_grandchild;
+			nodes[moved_grandchild].parent = node_index;
+			
+			refit_node(node_index);
+			refit_node(tall_child);
+			return tall_child;
+		}
+	};
+	
+	enum Solver_method {
+		SOLVER_GAUSS_SEIDEL, // corrects each contact in turn, so later contacts see earlier corrections.
+		SOLVER_JACOBI, // corrects every contact at once from the same poses, so it can be split across threads.
+	};
+	
+	struct Solver_settings {
+		Solver_method method = SOLVER_GAUSS_SEIDEL;
+		int max_iterations = 10;
+		double convergence_threshold = 0.0001; // stop once no shape is moved further than this in an iteration.
+		double relaxation = 0.8; // how much of each overlap is corrected per iteration. Less jitters less.
+		int thread_count = 1; // only for SOLVER_JACOBI.
+	};
+	
+	struct Solver_result {
+		int iterations;
+		double largest_correction; // in the last iteration.
+		bool converged;
+	};
+	
+	/*
+	Owns a set of shapes, finds which of them overlap with a built-in broadphase, and remembers each
+	nearby pair between steps. Move shapes by setting their pos and angle through get_shape() between
+	steps, and call step() to find out what started, kept on, and stopped overlapping.
+	
+	Static shapes go in a Static_bvh that's only rebuilt when static shapes are added, removed or moved,
+	and pairs of static shapes are never tested. Everything else goes in a Dynamic_tree.
+	
+	Dynamic shapes that overlap each other form islands. Once every shape in an island has kept still
+	for steps_until_sleep steps, the island falls asleep: its shapes stop looking for pairs, and pairs
+	between sleeping and static shapes keep their last state without being tested. An island wakes up
+	when one of its shapes is moved or removed, when an awake shape starts overlapping one of them, or
+	when a static shape is added, moved or removed near it.
+	*/
+	class World {
+	public:
+		int steps_until_sleep = 60; // negative to never sleep.
+		
+		Shape_handle add_shape(const Shape &shape, bool is_static = false) {
+			int slot_index;
+			if (free_slots.empty()) {
+				slot_index = slots.size();
+				assert(slot_index < INT_MAX);
+				slots.push_back(Slot());
+			} else {
+				slot_index = free_slots.back();
+				free_slots.pop_back();
+			}
+			
+			Slot &slot = slots[slot_index];
+			slot.shape = shape;
+			slot.in_use = true;
+			slot.last_angle = NAN; // counts as having moved on its first step.
+			slot.is_static = is_static;
+			slot.is_asleep = false;
+			slot.still_steps = 0;
+			
+			if (is_static) {
+				static_bvh_is_stale = true;
+			} else {
+				slot.tree_leaf = dynamic_tree.insert(get_aabb(slot.shape, get_aabb_margin(slot.shape)), slot_index);
+			}
+			
+			return make_handle(slot_index, slot.generation);
+		}
+		
+		/*
+		Adds the shapes of every chunk the stream has finished, without waiting for more, e.g. once a frame
+		while a level streams in. Invalid polygons are skipped. Returns how many shapes were added, and
+		appends their handles to handles_out if it's given. However many static shapes are added, the
+		Static_bvh is only rebuilt once, on the next step.
+		*/
+		int add_streamed_shapes(Shape_stream *stream, bool is_static = false, vector<Shape_handle> *handles_out = nullptr) {
+			int added_count = 0;
+			Shape_chunk chunk;
+			while (stream->try_take_chunk(&chunk)) {
+				for (int s = 0; s < chunk.shapes.size(); s++) {
+					if (chunk.errors[s] != POLYGON_OK) continue;
+					
+					Shape_handle handle = add_shape(chunk.shapes[s], is_static);
+					if (handles_out) handles_out->push_back(handle);
+					added_count++;
+				}
+			}
+			return added_count;
+		}
+		
+		// The shape's overlaps end on the next step. Does nothing if the handle is already invalid.
+		void remove_shape(Shape_handle handle) {
+			if (!is_valid(handle)) return;
+			
+			Slot &slot = slots[handle & SLOT_MASK];
+			if (slot.is_static) {
+				wake_islands_around_static(slot);
+				static_bvh_is_stale = true;
+			} else {
+				dynamic_tree.remove(slot.tree_leaf);
+			}
+			if (slot.is_asleep) islands_to_wake.push_back(slot.island);
+			
+			slot.in_use = false;
+			slot.generation++;
+			slot.shape = Shape(); // let go of the geometry.
+			free_slots.push_back(handle & SLOT_MASK);
+		}
+		
+		bool is_valid(Shape_handle handle) const {
+			Shape_handle slot_index = handle & SLOT_MASK;
+			return handle != NO_SHAPE && slot_index < slots.size()
+				&& slots[slot_index].in_use && slots[slot_index].generation == handle >> 32;
+		}
+		
+		// The pointer is only valid until the next call to add_shape(). Don't change the shape's geometry.
+		Shape *get_shape(Shape_handle handle) {
+			return is_valid(handle) ? &slots[handle & SLOT_MASK].shape : nullptr;
+		}
+		
+		/*
+		Pushes overlapping shapes apart. Every nearby pair the last step() found is a contact, even if
+		it wasn't overlapping yet, so shapes pushed into their neighbours get pushed back out. Each
+		contact's correction is split evenly between its shapes, unless one of them is static or asleep,
+		in which case the other takes all of it. Contacts are corrected repeatedly, with fresh overlap
+		amounts, until they converge or the iteration budget runs out.
+		*/
+		Solver_result resolve_overlaps(const Solver_settings &settings = Solver_settings()) {
+			RW_GJK_TRACE_SPAN("World::resolve_overlaps");
+			contacts.clear();
+			for (auto &pair : pairs) {
+				Shape_handle handle_a = pair.second.shape_a;
+				Shape_handle handle_b = pair.second.shape_b;
+				if (is_valid(handle_a) && is_valid(handle_b) && (is_movable(handle_a & SLOT_MASK) || is_movable(handle_b & SLOT_MASK))) {
+					contacts.push_back({ int(handle_a & SLOT_MASK), int(handle_b & SLOT_MASK) });
+				}
+			}
+			// the map's order depends on its history, and Gauss-Seidel's results depend on the order.
+			sort(contacts.begin(), contacts.end(), [](const pair<int, int> &a, const pair<int, int> &b) {
+				return get_pair_key(a.first, a.second) < get_pair_key(b.first, b.second);
+			});
+			
+			Solver_result result = { 0, 0, true };
+			if (contacts.empty()) return result;
+			
+			// the iterations only move shapes, so from here on the Jacobi threads only read the rotations.
+			for (auto &slot : slots) {
+				if (slot.in_use) update_rotation(&slot.shape);
+			}
+			
+			unique_ptr<Thread_team> team;
+			if (settings.method == SOLVER_JACOBI) {
+				contact_amounts.resize(contacts.size());
+				corrections.assign(slots.size(), v2(0, 0));
+				correction_counts.assign(slots.size(), 0);
+				team.reset(new Thread_team(max(1, min<int>(settings.thread_count, contacts.size()))));
+			}
+			
+			for (result.iterations = 1; result.iterations <= settings.max_iterations; result.iterations++) {
+				result.largest_correction = settings.method == SOLVER_JACOBI
+					? run_jacobi_iteration(settings, team.get()) : run_gauss_seidel_iteration(settings);
+				if (result.largest_correction <= settings.convergence_threshold) return result;
+			}
+			
+			result.iterations = settings.max_iterations;
+			result.converged = false;
+			return result;
+		}
+		
+		bool is_asleep(Shape_handle handle) const {
+			return is_valid(handle) && slots[handle & SLOT_MASK].is_asleep;
+		}
+		
+		// Returns the events for this step, which are kept until the next step.
+		const vector<Overlap_event> &step() {
+			RW_GJK_TRACE_SPAN("World::step");
+			events.clear();
+			step_count++;
+			
+			// the shapes are only read from here on, apart from their cached rotations.
+			for (auto &slot : slots) {
+				if (!slot.in_use) continue;
+				
+				update_rotation(&slot.shape);
+				slot.moved = !(slot.shape.pos == slot.last_pos && slot.shape.angle == slot.last_angle);
+				if (slot.is_static && slot.moved) wake_islands_around_static(slot);
+				slot.last_pos = slot.shape.pos;
+				slot.last_angle = slot.shape.angle;
+				
+				slot.still_steps = slot.moved ? 0 : slot.still_steps + 1;
+				if (slot.moved && slot.is_asleep) islands_to_wake.push_back(slot.island);
+			}
+			wake_islands();
+			
+			find_candidate_pairs();
+			
+			for (auto &candidate : candidates) {
+				Slot &slot_a = slots[candidate.first];
+				Slot &slot_b = slots[candidate.second];
+				Shape_handle handle_a = make_handle(candidate.first, slot_a.generation);
+				Shape_handle handle_b = make_handle(candidate.second, slot_b.generation);
+				
+				// pairs that weren't candidates last step were dropped from the cache, so they start out separated.
+				Pair &pair = pairs[get_pair_key(candidate.first, candidate.second)];
+				if (pair.shape_a != handle_a || pair.shape_b != handle_b) {
+					// the cached pair belonged to shapes that have since been removed, and their slots reused.
+					if (pair.overlapping) events.push_back({ OVERLAP_END, pair.shape_a, pair.shape_b });
+					pair = Pair();
+					pair.shape_a = handle_a;
+					pair.shape_b = handle_b;
+				}
+				bool was_overlapping = pair.overlapping;
+				
+				// a pair that was tested last step and hasn't moved since can't have changed.
+				bool is_unchanged = pair.last_step == step_count - 1 && !slot_a.moved && !slot_b.moved;
+				if (!is_unchanged) {
+					pair.overlapping = pair_is_overlapping(&slot_a.shape, &slot_b.shape, &pair.separating_axis);
 					
-					// find the point on the line that is closest to the origin.
-					v2 simplex_line_unit = simplex_line.normalised_or_0();
-					double len = dot(simplex_line_unit, ORIGIN - simplex[line_start_index]);
-					v2 point_of_overlap = simplex[line_start_index] + simplex_line_unit * len;
+					// something has run into a sleeping island.
+					if (pair.overlapping && slot_a.is_asleep) islands_to_wake.push_back(slot_a.island);
+					if (pair.overlapping && slot_b.is_asleep) islands_to_wake.push_back(slot_b.island);
+				}
+				pair.last_step = step_count;
+				
+				if (pair.overlapping) {
+					events.push_back({ was_overlapping ? OVERLAP_PERSIST : OVERLAP_BEGIN, handle_a, handle_b });
+				} else if (was_overlapping) {
+					events.push_back({ OVERLAP_END, handle_a, handle_b });
+				}
+			}
+			
+			// pairs that weren't candidates this step have drifted apart, or lost a shape, or are asleep.
+			int first_swept_event = events.size();
+			for (auto pair = pairs.begin(); pair != pairs.end(); ) {
+				Shape_handle handle_a = pair->second.shape_a;
+				Shape_handle handle_b = pair->second.shape_b;
+				
+				if (pair->second.last_step != step_count && is_frozen(handle_a) && is_frozen(handle_b)) {
+					pair->second.last_step = step_count;
+					if (pair->second.overlapping) events.push_back({ OVERLAP_PERSIST, handle_a, handle_b });
+				}
+				
+				if (pair->second.last_step == step_count) {
+					++pair;
+					continue;
+				}
+				
+				if (pair->second.overlapping) events.push_back({ OVERLAP_END, handle_a, handle_b });
+				pair = pairs.erase(pair);
+			}
+			// put the map's events in an order that doesn't depend on its history.
+			sort(events.begin() + first_swept_event, events.end(), [](const Overlap_event &a, const Overlap_event &b) {
+				return get_pair_key(a.shape_a & SLOT_MASK, a.shape_b & SLOT_MASK) < get_pair_key(b.shape_a & SLOT_MASK, b.shape_b & SLOT_MASK);
+			});
+			
+			wake_islands();
+			put_still_islands_to_sleep();
+			return events;
+		}
+		
+	private:
+		static const Shape_handle SLOT_MASK = UINT32_MAX;
+		
+		struct Slot {
+			Shape shape;
+			uint32_t generation = 0;
+			bool in_use = false;
+			bool is_static;
+			int tree_leaf; // only for dynamic shapes.
+			
+			// the pose at the last step, and whether it changed since the step before.
+			v2 last_pos;
+			float last_angle = NAN;
+			bool moved;
+			int still_steps; // how many steps in a row it hasn't moved for.
+			
+			bool is_asleep;
+			int island; // the slot index that identifies the shape's island, while it's asleep.
+		};
+		
+		// What the world remembers about a pair of nearby shapes between steps.
+		struct Pair {
+			Shape_handle shape_a = NO_SHAPE, shape_b = NO_SHAPE;
+			bool overlapping = false;
+			int last_step = -1;
+			v2 separating_axis = v2(0, 0); // the axis that last separated the shapes, tried first next step.
+		};
+		
+		vector<Slot> slots;
+		vector<int> free_slots;
+		unordered_map<uint64_t, Pair> pairs; // keyed by the pair's slot indices.
+		Static_bvh static_bvh;
+		bool static_bvh_is_stale = false;
+		vector<Static_bvh::Item> static_items;
+		Dynamic_tree dynamic_tree;
+		vector<pair<int, int>> candidates; // slot indices, lower first.
+		vector<Overlap_event> events;
+		int step_count = 0;
+		vector<int> islands_to_wake;
+		vector<pair<int, int>> contacts; // slot indices of overlapping pairs, for the solver.
+		vector<v2> contact_amounts;
+		vector<v2> corrections;
+		vector<int> correction_counts;
+		vector<int> island_parents; // a union-find forest over slot indices.
+		vector<int> island_still_steps;
+		vector<char> island_marks;
+		
+		static Shape_handle make_handle(int slot_index, uint32_t generation) {
+			return Shape_handle(slot_index) | (Shape_handle(generation) << 32);
+		}
+		
+		static uint64_t get_pair_key(int slot_a, int slot_b) {
+			return uint64_t(slot_a) | (uint64_t(slot_b) << 32);
+		}
+		
+		bool is_movable(int slot_index) const {
+			return slots[slot_index].in_use && !slots[slot_index].is_static && !slots[slot_index].is_asleep;
+		}
+		
+		// How much of a contact's correction goes to the first shape, the rest going to the second.
+		double get_share_of_first(const pair<int, int> &contact) const {
+			bool a_is_movable = is_movable(contact.first);
+			bool b_is_movable = is_movable(contact.second);
+			return a_is_movable && b_is_movable ? 0.5 : a_is_movable ? 1 : 0;
+		}
+		
+		double run_gauss_seidel_iteration(const Solver_settings &settings) {
+			double largest_correction = 0;
+			for (auto &contact : contacts) {
+				Shape *shape_a = &slots[contact.first].shape;
+				Shape *shape_b = &slots[contact.second].shape;
+				v2 amount = get_overlap_amount(shape_a, shape_b) * settings.relaxation;
+				
+				double share_of_a = get_share_of_first(contact);
+				shape_a->pos = shape_a->pos - amount * share_of_a;
+				shape_b->pos = shape_b->pos + amount * (1 - share_of_a);
+				largest_correction = fmax(largest_correction, amount.length() * fmax(share_of_a, 1 - share_of_a));
+			}
+			return largest_correction;
+		}
+		
+		/*
+		Every contact's overlap is measured from the same poses, which is what makes it safe to split
+		across threads. A shape in several contacts gets the average of their corrections, since adding
+		them up would overshoot.
+		*/
+		double run_jacobi_iteration(const Solver_settings &settings, Thread_team *team) {
+			team->for_each_index(contacts.size(), [&](int c) {
+				contact_amounts[c] = get_overlap_amount(&slots[contacts[c].first].shape, &slots[contacts[c].second].shape);
+			});
+			
+			for (int c = 0; c < contacts.size(); c++) {
+				if (contact_amounts[c] == v2(0, 0)) continue; // not overlapping.
+				
+				double share_of_a = get_share_of_first(contacts[c]);
+				if (share_of_a > 0) {
+					corrections[contacts[c].first] = corrections[contacts[c].first] - contact_amounts[c] * share_of_a;
+					correction_counts[contacts[c].first]++;
+				}
+				if (share_of_a < 1) {
+					corrections[contacts[c].second] = corrections[contacts[c].second] + contact_amounts[c] * (1 - share_of_a);
+					correction_counts[contacts[c].second]++;
+				}
+			}
+			
+			double largest_correction = 0;
+			for (auto &contact : contacts) {
+				for (int s : { contact.first, contact.second }) {
+					if (correction_counts[s] == 0) continue; // already applied, or immovable.
 					
-					// the difference between the origin and that point is the overlap amount.
-					v2 overlap_vector = point_of_overlap - ORIGIN;
-					return overlap_vector.normalised_or_0() * (overlap_vector.length() + LINE_THICKNESS);
+					v2 correction = corrections[s] * (settings.relaxation / correction_counts[s]);
+					slots[s].shape.pos = slots[s].shape.pos + correction;
+					largest_correction = fmax(largest_correction, correction.length());
+					corrections[s] = v2(0, 0);
+					correction_counts[s] = 0;
 				}
 			}
+			return largest_correction;
+		}
+		
+		// Whether the shape's pairs can be left as they were, because it's asleep, static or gone.
+		bool is_frozen(Shape_handle handle) const {
+			return !is_valid(handle) ? false : slots[handle & SLOT_MASK].is_static || slots[handle & SLOT_MASK].is_asleep;
+		}
+		
+		/*
+		Static shapes never look for pairs, and neither do sleeping ones, so when a static shape is added,
+		moved or removed, the sleeping islands at its old and new bounds are woken to look for it instead.
+		*/
+		void wake_islands_around_static(const Slot &slot) {
+			auto wake_islands_touching = [&](const Aabb &aabb) {
+				dynamic_tree.query(aabb, [&](int other) {
+					if (slots[other].is_asleep) islands_to_wake.push_back(slots[other].island);
+				});
+			};
 			
-			// else add the new corner to the simplex, turning the existing line into two.
-			simplex.insert(simplex.begin()+line_end_index, new_corner);
-			assert(!contains_duplicates(simplex));
-		} // end while
-	}
+			wake_islands_touching(get_aabb(slot.shape));
+			if (!isnan(slot.last_angle)) { // it's been through a step, so it has old bounds.
+				v2 extent = v2(slot.shape.radius, slot.shape.radius);
+				wake_islands_touching({ slot.last_pos - extent, slot.last_pos + extent });
+			}
+		}
+		
+		void wake_islands() {
+			if (islands_to_wake.empty()) return;
+			
+			island_marks.assign(slots.size(), false);
+			for (int island : islands_to_wake) island_marks[island] = true;
+			islands_to_wake.clear();
+			
+			for (auto &slot : slots) {
+				if (slot.in_use && slot.is_asleep && island_marks[slot.island]) {
+					slot.is_asleep = false;
+					slot.still_steps = 0;
+				}
+			}
+		}
+		
+		int find_island(int slot_index) {
+			while (island_parents[slot_index] != slot_index) {
+				island_parents[slot_index] = island_parents[island_parents[slot_index]]; // path halving.
+				slot_index = island_parents[slot_index];
+			}
+			return slot_index;
+		}
+		
+		// Joins awake dynamic shapes that overlap into islands, and puts islands that have kept still to sleep.
+		void put_still_islands_to_sleep() {
+			if (steps_until_sleep < 0) return;
+			
+			island_parents.resize(slots.size());
+			for (int s = 0; s < slots.size(); s++) island_parents[s] = s;
+			
+			auto is_awake_and_dynamic = [&](int slot_index) {
+				return slots[slot_index].in_use && !slots[slot_index].is_static && !slots[slot_index].is_asleep;
+			};
+			
+			for (auto &pair : pairs) {
+				int slot_a = pair.first & SLOT_MASK;
+				int slot_b = (pair.first >> 32) & SLOT_MASK;
+				if (!pair.second.overlapping || !is_awake_and_dynamic(slot_a) || !is_awake_and_dynamic(slot_b)) continue;
+				
+				island_parents[find_island(slot_a)] = find_island(slot_b);
+			}
+			
+			// an island is only as still as its least still shape.
+			island_still_steps.assign(slots.size(), INT_MAX);
+			for (int s = 0; s < slots.size(); s++) {
+				if (!is_awake_and_dynamic(s)) continue;
+				int island = find_island(s);
+				island_still_steps[island] = min(island_still_steps[island], slots[s].still_steps);
+			}
+			
+			for (int s = 0; s < slots.size(); s++) {
+				if (!is_awake_and_dynamic(s)) continue;
+				int island = find_island(s);
+				if (island_still_steps[island] >= steps_until_sleep) {
+					slots[s].is_asleep = true;
+					slots[s].island = island;
+				}
+			}
+		}
+		
+		// How far a dynamic shape can move before its leaf in the tree has to be moved too.
+		static double get_aabb_margin(const Shape &shape) {
+			return shape.radius * 0.25;
+		}
+		
+		void find_candidate_pairs() {
+			RW_GJK_TRACE_SPAN("broadphase");
+			for (auto &slot : slots) {
+				if (slot.in_use && slot.is_static && slot.moved) static_bvh_is_stale = true;
+			}
+			
+			if (static_bvh_is_stale) {
+				static_items.clear();
+				for (int s = 0; s < slots.size(); s++) {
+					if (slots[s].in_use && slots[s].is_static) static_items.push_back({ get_aabb(slots[s].shape), s });
+				}
+				static_bvh.build(static_items);
+				static_bvh_is_stale = false;
+			}
+			
+			// move the leaves of dynamic shapes that have left their fattened bounds.
+			for (int s = 0; s < slots.size(); s++) {
+				Slot &slot = slots[s];
+				if (!slot.in_use || slot.is_static || !slot.moved) continue;
+				
+				if (!aabb_contains(dynamic_tree.get_leaf_aabb(slot.tree_leaf), get_aabb(slot.shape))) {
+					dynamic_tree.remove(slot.tree_leaf);
+					slot.tree_leaf = dynamic_tree.insert(get_aabb(slot.shape, get_aabb_margin(slot.shape)), s);
+				}
+			}
+			
+			// only dynamic shapes look for pairs, so static shapes are never paired with each other.
+			candidates.clear();
+			for (int s = 0; s < slots.size(); s++) {
+				if (!slots[s].in_use || slots[s].is_static || slots[s].is_asleep) continue;
+				
+				Aabb aabb = get_aabb(slots[s].shape);
+				static_bvh.query(aabb, [&](int other) {
+					candidates.push_back({ min(s, other), max(s, other) });
+				});
+				dynamic_tree.query(aabb, [&](int other) {
+					// awake shapes find each other, so only keep one of each pair, and skip the shape itself.
+					if (other == s || !aabbs_overlap(aabb, get_aabb(slots[other].shape))) return;
+					if (other > s || slots[other].is_asleep) candidates.push_back({ min(s, other), max(s, other) });
+				});
+			}
+		}
+		
+		/*
+		Most pairs that were separated last step are still separated along the same axis, which only
+		takes one support query to confirm. Otherwise this falls back on GJK, which finds a new axis.
+		*/
+		bool pair_is_overlapping(Shape *shape_a, Shape *shape_b, v2 *separating_axis) {
+			double line_thickness = get_line_thickness(shape_a, shape_b);
+			
+			if (!separating_axis->is_0()) {
+				double corner_distance = dot(get_minkowski_diffed_corner(shape_a, shape_b, *separating_axis), *separating_axis);
+				if (corner_distance < 0 && corner_distance*corner_distance
+					> line_thickness*line_thickness * dot(*separating_axis, *separating_axis)) {
+					return false;
+				}
+			}
+			
+			*separating_axis = v2(0, 0);
+			Status status;
+			return simplex_contains_origin(
+				shape_a, shape_b, line_thickness, &thread_workspace.simplex, &status, separating_axis);
+		}
+	};
 }
 
 /*
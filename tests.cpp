@@ -5,11 +5,21 @@ g++ -std=c++11 tests.cpp -o tests && ./tests
 I personally like to use:
 clear && echo Compiling... && g++ -std=c++11 tests.cpp -o tests && ./tests && rm tests
 to clear the terminal beforehand and delete the executable after I'm done with it.
+
+Or build and run them with CMake, where they exit with a non-zero code if any of them fail:
+cmake -S . -B build && cmake --build build && ctest --test-dir build --output-on-failure
 */
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
 #include <string>
 
+#ifndef RW_GJK_STATS
+	#define RW_GJK_STATS
+#endif
 #include "rw_gjk.cpp"
 
 using namespace rw_gjk;
@@ -207,6 +217,38 @@ int main() {
 		print_test_result(!try_make_polygon(corners, &shape));
 	}
 	
+	{
+		print_test_name("Normals point outward");
+		vector<v2> corners = { v2(0, 0), v2(1, 1), v2(1, 0), v2(0, 1) };
+		bool success = try_make_polygon(corners, &shape);
+		
+		for (int c = 0; c < shape.corner_count; c++) {
+			v2 edge = shape.corners[(c+1) % shape.corner_count] - shape.corners[c];
+			v2 outward = shape.corners[c] - v2(0.5, 0.5);
+			success = success && fabs(shape.normals[c].length() - 1) < 0.000001
+				&& fabs(dot(shape.normals[c], edge)) < 0.000001
+				&& dot(shape.normals[c], outward) > 0;
+		}
+		
+		print_test_result(success);
+	}
+	
+	{
+		print_test_name("Baked normals rotate with the shape");
+		vector<v2> corners = { v2(-1, -1), v2(1, -1), v2(1, 1), v2(-1, 1) };
+		bool success = try_make_polygon(corners, &shape);
+		shape.angle = M_PI / 2;
+		
+		for (int c = 0; c < shape.corner_count; c++) {
+			v2 baked_corner = shape.corners[c].rotated(shape.angle);
+			v2 next_baked_corner = shape.corners[(c+1) % shape.corner_count].rotated(shape.angle);
+			v2 expected_normal = (next_baked_corner - baked_corner).right_normal_or_0();
+			success = success && get_baked_normal(&shape, c).distance(expected_normal) < 0.000001;
+		}
+		
+		print_test_result(success);
+	}
+	
 	{
 		print_test_name("Invalid polygon, duplicate corners");
 		vector<v2> corners = {
@@ -215,6 +257,412 @@ int main() {
 		print_test_result(!try_make_polygon(corners, &shape));
 	}
 	
+	{
+		print_test_name("Moved-in corners become the shape's storage");
+		vector<v2> corners = { v2(0, 0), v2(1, 0), v2(1, 1) };
+		corners.reserve(6);
+		const v2 *storage = corners.data();
+		bool success = try_make_polygon(move(corners), &shape);
+		print_test_result(success && shape.corners == storage && shape.corner_count == 3);
+	}
+	
+	{
+		print_test_name("Invalid moved-in corners are left untouched");
+		vector<v2> corners = { v2(0, 0), v2(0, 1), v2(1, 1), v2(0.1, 0.9) };
+		bool success = !try_make_polygon(move(corners), &shape);
+		print_test_result(success && corners.size() == 4);
+	}
+	
+	{
+		print_test_name("Corners from part of a larger buffer");
+		v2 vertex_buffer[] = { v2(5, 5), v2(0, 0), v2(1, 0), v2(1, 1), v2(5, 5) };
+		bool success = try_make_polygon(vertex_buffer + 1, 3, &shape);
+		print_test_result(success && shape.corner_count == 3 && shape.radius == sqrt(2));
+	}
+	
+	printf("\nmake_polygons():\n");
+	{
+		vector<v2> vertices = {
+			v2(0, 0), v2(0, 1), v2(1, 1), // valid, clockwise.
+			v2(0, 0), v2(1, 0), // too few corners.
+			v2(0, 0), v2(0, 1), v2(1, 1), v2(0.1, 0.9), // concave.
+			v2(-1, -1), v2(1, -1), v2(1, 1), v2(-1, 1), // valid.
+			v2(0, 0), v2(0, 0), v2(1, 0), // duplicate corners.
+		};
+		vector<int> offsets = { 0, 3, 5, 9, 13, 16 };
+		const int POLYGON_COUNT = 5;
+		
+		{
+			print_test_name("Error codes and shapes");
+			Shape shapes[POLYGON_COUNT];
+			Polygon_error errors[POLYGON_COUNT];
+			int valid_count = make_polygons(vertices.data(), offsets.data(), POLYGON_COUNT, shapes, errors);
+			
+			bool success = valid_count == 2
+				&& errors[0] == POLYGON_OK && errors[1] == POLYGON_TOO_FEW_CORNERS && errors[2] == POLYGON_NOT_CONVEX
+				&& errors[3] == POLYGON_OK && errors[4] == POLYGON_DUPLICATE_CORNERS;
+			
+			// the valid shapes share one pool, and match shapes made one at a time.
+			Shape single;
+			try_make_polygon(vector<v2>(vertices.begin() + 9, vertices.begin() + 13), &single);
+			success = success && shapes[0].owned_geometry == shapes[3].owned_geometry
+				&& shapes[3].corner_count == 4 && shapes[3].radius == single.radius;
+			for (int c = 0; c < 4; c++) {
+				success = success && shapes[3].corners[c] == single.corners[c] && shapes[3].normals[c] == single.normals[c];
+			}
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Many threads give the same shapes as one");
+			vector<v2> many_vertices;
+			vector<int> many_offsets = { 0 };
+			for (int p = 0; p < 1000; p++) {
+				for (int v = 9; v < 13; v++) many_vertices.push_back(vertices[v] * (p+1));
+				many_offsets.push_back(many_vertices.size());
+			}
+			
+			vector<Shape> shapes_1(1000), shapes_4(1000);
+			vector<Polygon_error> errors_1(1000), errors_4(1000);
+			int valid_count_1 = make_polygons(many_vertices.data(), many_offsets.data(), 1000, shapes_1.data(), errors_1.data(), 1);
+			int valid_count_4 = make_polygons(many_vertices.data(), many_offsets.data(), 1000, shapes_4.data(), errors_4.data(), 4);
+			
+			bool success = valid_count_1 == 1000 && valid_count_4 == 1000;
+			for (int p = 0; p < 1000; p++) {
+				success = success && shapes_1[p].radius == shapes_4[p].radius && shapes_4[p].corner_count == 4;
+				for (int c = 0; c < 4; c++) success = success && shapes_1[p].corners[c] == shapes_4[p].corners[c];
+			}
+			
+			print_test_result(success);
+		}
+	}
+	
+	printf("\nCooked shape files:\n");
+	{
+		const string PATH = "tests_cooked_shapes.bin";
+		vector<Shape> shapes(4);
+		try_make_polygon({ v2(0, 0), v2(1, 0), v2(1, 1) }, &shapes[0]);
+		make_circle(0.5, &shapes[1]);
+		try_make_box(2, 1, &shapes[2]);
+		try_make_capsule(v2(0, -1), v2(0, 1), 0.25, &shapes[3]);
+		bool written = write_cooked_shapes(PATH, shapes.data(), shapes.size());
+		
+		// reads a whole file into memory, for the buffer overload, which works without mmap too.
+		auto read_file = [](const string &path, size_t *size_out) {
+			shared_ptr<const void> data;
+			FILE *file = fopen(path.c_str(), "rb");
+			if (!file) return data;
+			fseek(file, 0, SEEK_END);
+			*size_out = ftell(file);
+			rewind(file);
+			
+			// uint64_t keeps the buffer aligned for the doubles in it.
+			auto buffer = make_shared<vector<uint64_t>>((*size_out + 7) / 8);
+			if (fread(buffer->data(), 1, *size_out, file) == *size_out) data = shared_ptr<const void>(buffer, buffer->data());
+			fclose(file);
+			return data;
+		};
+		
+		// maps the file where there's mmap.
+		auto load_file = [&](const string &path, vector<Shape> *shapes_out) {
+			#ifdef RW_GJK_HAS_MMAP
+				return try_load_cooked_shapes(path, shapes_out);
+			#else
+				size_t size;
+				auto buffer = read_file(path, &size);
+				return buffer && try_load_cooked_shapes(buffer, size, shapes_out);
+			#endif
+		};
+		
+		{
+			print_test_name("Loaded shapes match the cooked ones");
+			vector<Shape> loaded;
+			bool success = written && load_file(PATH, &loaded) && loaded.size() == shapes.size();
+			
+			for (int s = 0; s < loaded.size() && success; s++) {
+				success = loaded[s].corner_count == shapes[s].corner_count && loaded[s].radius == shapes[s].radius
+					&& loaded[s].rounding == shapes[s].rounding && loaded[s].is_circle == shapes[s].is_circle
+					&& loaded[s].is_box == shapes[s].is_box;
+				for (int c = 0; c < loaded[s].corner_count; c++) {
+					success = success && loaded[s].corners[c] == shapes[s].corners[c] && loaded[s].normals[c] == shapes[s].normals[c];
+				}
+			}
+			
+			// the shapes keep the file mapped after the vector that loaded them is gone.
+			if (success) {
+				Shape box = loaded[2];
+				loaded.clear();
+				box.pos = v2(0.5, 0);
+				shapes[2].pos = v2(0.5, 0);
+				v2 amount = get_overlap_amount(&box, &shapes[3]);
+				success = !amount.is_0() && amount == get_overlap_amount(&shapes[2], &shapes[3]);
+			}
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Truncated or mislabelled files are rejected");
+			FILE *file = fopen(PATH.c_str(), "r+b");
+			fputc('X', file); // overwrite the magic.
+			fclose(file);
+			vector<Shape> loaded;
+			bool success = !load_file(PATH, &loaded);
+			
+			written = write_cooked_shapes(PATH, shapes.data(), shapes.size());
+			size_t size;
+			auto buffer = read_file(PATH, &size);
+			success = success && written && buffer
+				&& !try_load_cooked_shapes(buffer, sizeof(Cooked_header) + sizeof(Cooked_shape), &loaded) && loaded.empty();
+			success = success && !load_file("no_such_file.bin", &loaded);
+			
+			print_test_result(success);
+		}
+		
+		remove(PATH.c_str());
+	}
+	
+	printf("\nShape_stream:\n");
+	{
+		auto write_definition = [](FILE *file, vector<v2> corners) {
+			int32_t corner_count = corners.size();
+			fwrite(&corner_count, sizeof(corner_count), 1, file);
+			fwrite(corners.data(), sizeof(v2), corners.size(), file);
+		};
+		
+		auto take_every_chunk = [](Shape_stream &stream, vector<Shape_chunk> *chunks_out) {
+			while (!stream.is_finished()) {
+				Shape_chunk chunk;
+				if (stream.try_take_chunk(&chunk)) chunks_out->push_back(move(chunk));
+				else this_thread::yield();
+			}
+		};
+		
+		{
+			print_test_name("Streams every shape in bounded chunks");
+			FILE *file = tmpfile();
+			for (int s = 0; s < 10; s++) {
+				write_definition(file, { v2(0, 0), v2(s+1, 0), v2(0, s+1) });
+				if (s == 4) write_definition(file, { v2(0, 0), v2(1, 0) }); // too few corners.
+			}
+			rewind(file);
+			
+			vector<Shape_chunk> chunks;
+			bool success;
+			{
+				Shape_stream stream(file, 3, 2);
+				take_every_chunk(stream, &chunks);
+				success = !stream.had_read_error();
+			}
+			fclose(file);
+			
+			int shape_count = 0;
+			int valid_count = 0;
+			for (auto &chunk : chunks) {
+				success = success && chunk.shapes.size() <= 3 && chunk.shapes.size() == chunk.errors.size();
+				for (int s = 0; s < chunk.shapes.size(); s++) {
+					shape_count++;
+					if (chunk.errors[s] == POLYGON_OK) {
+						success = success && chunk.shapes[s].radius == valid_count + 1;
+						valid_count++;
+					} else {
+						success = success && chunk.errors[s] == POLYGON_TOO_FEW_CORNERS;
+					}
+				}
+			}
+			
+			print_test_result(success && shape_count == 11 && valid_count == 10);
+		}
+		
+		{
+			print_test_name("Truncated stream is a read error");
+			FILE *file = tmpfile();
+			write_definition(file, { v2(0, 0), v2(1, 0), v2(0, 1) });
+			int32_t corner_count = 3;
+			fwrite(&corner_count, sizeof(corner_count), 1, file);
+			fwrite(&corner_count, sizeof(corner_count), 1, file); // not enough for even one corner.
+			rewind(file);
+			
+			vector<Shape_chunk> chunks;
+			bool success;
+			{
+				Shape_stream stream(file);
+				take_every_chunk(stream, &chunks);
+				success = stream.had_read_error();
+			}
+			fclose(file);
+			
+			print_test_result(success && chunks.size() == 1 && chunks[0].shapes.size() == 1);
+		}
+		
+		{
+			print_test_name("Streamed shapes go straight into a World");
+			FILE *file = tmpfile();
+			for (int s = 0; s < 10; s++) {
+				write_definition(file, { v2(s*3, 0), v2(s*3 + 1, 0), v2(s*3, 1) });
+				if (s == 4) write_definition(file, { v2(0, 0), v2(1, 0) }); // too few corners.
+			}
+			rewind(file);
+			
+			World world;
+			vector<Shape_handle> handles;
+			int added_count = 0;
+			{
+				Shape_stream stream(file, 3, 2);
+				while (!stream.is_finished()) {
+					int newly_added = world.add_streamed_shapes(&stream, true, &handles);
+					if (newly_added == 0) this_thread::yield();
+					added_count += newly_added;
+				}
+			}
+			fclose(file);
+			
+			Shape visitor;
+			make_circle(0.5, &visitor);
+			visitor.pos = v2(9.2, 0.2); // on the fourth triangle.
+			world.add_shape(visitor);
+			const vector<Overlap_event> &events = world.step();
+			
+			bool success = added_count == 10 && handles.size() == 10 && events.size() == 1
+				&& events[0].type == OVERLAP_BEGIN && (events[0].shape_a == handles[3] || events[0].shape_b == handles[3]);
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Destroying an unfinished stream");
+			FILE *file = tmpfile();
+			for (int s = 0; s < 100; s++) write_definition(file, { v2(0, 0), v2(1, 0), v2(0, 1) });
+			rewind(file);
+			{
+				Shape_stream stream(file, 1, 1); // the queue fills up, and nothing is ever taken.
+			}
+			fclose(file);
+			print_test_result(true); // success means it didn't hang.
+		}
+	}
+	
+	printf("\nFixedPolygon:\n");
+	{
+		constexpr FixedPolygon<4> SQUARE(v2(-0.1, -0.1), v2(0.1, -0.1), v2(0.1, 0.1), v2(-0.1, 0.1));
+		static_assert(SQUARE.is_valid(), "SQUARE should be valid");
+		static_assert(!FixedPolygon<3>(v2(0, 0), v2(0, 1), v2(1, 0)).is_valid(), "Clockwise corners should be invalid");
+		static_assert(!FixedPolygon<4>(v2(0, 0), v2(1, 0), v2(2, 0), v2(1, 1)).is_valid(), "Colinear corners should be invalid");
+		static_assert(!FixedPolygon<4>(v2(0, 0), v2(1, 0), v2(0.1, 0.1), v2(0, 1)).is_valid(), "Concave corners should be invalid");
+		static_assert(!FixedPolygon<3>(v2(0, 0), v2(0, 0), v2(0, 1)).is_valid(), "Duplicate corners should be invalid");
+		
+		{
+			print_test_name("Normals match a heap-allocated polygon's");
+			Shape fixed_shape, heap_shape;
+			bool success = try_make_polygon(SQUARE, &fixed_shape);
+			success = success && try_make_polygon(
+				vector<v2>(SQUARE.corners, SQUARE.corners + 4), &heap_shape);
+			
+			for (int c = 0; c < 4; c++) {
+				success = success && fixed_shape.normals[c].distance(heap_shape.normals[c]) < 0.000000000001;
+			}
+			
+			print_test_result(success && fixed_shape.corners == SQUARE.corners && !fixed_shape.owned_geometry);
+		}
+		
+		{
+			print_test_name("Overlaps like a heap-allocated polygon");
+			Shape fixed_a, fixed_b, heap_a, heap_b;
+			vector<v2> corners(SQUARE.corners, SQUARE.corners + 4);
+			try_make_polygon(SQUARE, &fixed_a);
+			try_make_polygon(SQUARE, &fixed_b);
+			try_make_polygon(corners, &heap_a);
+			try_make_polygon(corners, &heap_b);
+			fixed_a.pos = heap_a.pos = v2(0.05, 0.12);
+			fixed_a.angle = heap_a.angle = 0.3;
+			
+			v2 fixed_amount = get_overlap_amount(&fixed_a, &fixed_b);
+			v2 heap_amount = get_overlap_amount(&heap_a, &heap_b);
+			print_test_result(!fixed_amount.is_0() && fixed_amount == heap_amount);
+		}
+		
+		{
+			print_test_name("Copied shapes share their corners");
+			Shape heap_shape;
+			try_make_polygon(vector<v2>(SQUARE.corners, SQUARE.corners + 4), &heap_shape);
+			Shape copied_shape = heap_shape;
+			heap_shape = Shape();
+			print_test_result(copied_shape.corners == static_cast<const vector<v2> *>(copied_shape.owned_geometry.get())->data()
+				&& copied_shape.corners[2] == v2(0.1, 0.1));
+		}
+	}
+	
+	printf("\ntry_make_capsule() and friends:\n");
+	{
+		print_test_name("Valid segment");
+		print_test_result(try_make_segment(v2(0, 0), v2(1, 1), &shape));
+	}
+	
+	{
+		print_test_name("Invalid segment, identical corners");
+		print_test_result(!try_make_segment(v2(1, 1), v2(1, 1), &shape));
+	}
+	
+	{
+		print_test_name("Valid capsule");
+		bool success = try_make_capsule(v2(0, -1), v2(0, 1), 0.5, &shape);
+		print_test_result(success && shape.radius == 1.5 && shape.rounding == 0.5);
+	}
+	
+	{
+		print_test_name("Invalid capsule, negative radius");
+		print_test_result(!try_make_capsule(v2(0, -1), v2(0, 1), -0.5, &shape));
+	}
+	
+	{
+		print_test_name("Invalid capsule, NAN radius");
+		print_test_result(!try_make_capsule(v2(0, -1), v2(0, 1), NAN, &shape));
+	}
+	
+	{
+		print_test_name("Valid rounded polygon");
+		vector<v2> corners = { v2(0, 0), v2(1, 0), v2(1, 1) };
+		bool success = try_make_rounded_polygon(corners, 0.25, &shape);
+		print_test_result(success && shape.rounding == 0.25);
+	}
+	
+	{
+		print_test_name("Invalid rounded polygon, concave");
+		vector<v2> corners = { v2(0, 0), v2(0, 1), v2(1, 1), v2(0.1, 0.9) };
+		print_test_result(!try_make_rounded_polygon(corners, 0.25, &shape));
+	}
+	
+	{
+		print_test_name("Valid box");
+		bool success = try_make_box(2, 1, &shape);
+		print_test_result(success && shape.is_box && shape.corner_count == 4
+			&& shape.half_size == v2(1, 0.5) && shape.radius == v2(1, 0.5).length());
+	}
+	
+	{
+		print_test_name("Invalid box, zero width");
+		print_test_result(!try_make_box(0, 1, &shape));
+	}
+	
+	{
+		print_test_name("Invalid box, NAN height");
+		print_test_result(!try_make_box(1, NAN, &shape));
+	}
+	
+	{
+		print_test_name("Valid polygon with margin");
+		vector<v2> corners = { v2(-1, -1), v2(1, 1), v2(1, -1), v2(-1, 1) };
+		bool success = try_make_polygon_with_margin(corners, 0.1, &shape);
+		print_test_result(success && shape.rounding == 0.1
+			&& fabs(shape.radius - (sqrt(2*0.9*0.9) + 0.1)) < 0.000001);
+	}
+	
+	{
+		print_test_name("Invalid polygon with margin, margin too large");
+		vector<v2> corners = { v2(-1, -1), v2(1, -1), v2(1, 1), v2(-1, 1) };
+		print_test_result(!try_make_polygon_with_margin(corners, 1.5, &shape));
+	}
+	
 	{
 		printf("\nshapes_are_overlapping():\n");
 		// const double AMOUNT_TOLERANCE = 0.000001;
@@ -304,12 +752,32 @@ int main() {
 			print_test_result(!shapes_are_overlapping(&shape_a, &shape_b));
 		}
 		
+		{
+			print_test_name("Capsule overlaps polygon with its rounding only");
+			Shape capsule;
+			try_make_capsule(v2(0, -1), v2(0, 1), 0.5, &capsule);
+			capsule.pos = v2(0.5, 0);
+			shape_b.pos = v2(0, 0);
+			bool overlapping = shapes_are_overlapping(&capsule, &shape_b);
+			capsule.pos = v2(0.7, 0);
+			print_test_result(overlapping && !shapes_are_overlapping(&capsule, &shape_b));
+		}
+		
+		{
+			print_test_name("Segments cross");
+			Shape a, b;
+			try_make_segment(v2(-1, 0), v2(1, 0), &a);
+			try_make_segment(v2(0, -1), v2(0, 1), &b);
+			a.pos = v2(0.1, 0.2);
+			print_test_result(shapes_are_overlapping(&a, &b));
+		}
+		
 		{
 			print_test_name("Brute force test");
 			bool success = true;
 			
 			for (int outer = 0; outer < 100; outer++) {
-				Shape shapes[4];
+				Shape shapes[5];
 				
 				success = success && try_make_polygon({
 					v2(randf()-0.5, randf()-0.5),
@@ -324,16 +792,18 @@ int main() {
 				
 				make_circle(randf()*3, &shapes[2]);
 				make_circle(randf()*3, &shapes[3]);
+				success = success && try_make_capsule(
+					v2(randf()-0.5, randf()-0.5), v2(randf()-0.5, randf()-0.5), randf(), &shapes[4]);
 				
 				for (int inner = 0; inner < 100; inner++) {
-					for (int s = 0; s < 4; s++) {
+					for (int s = 0; s < 5; s++) {
 						shapes[s].pos.x = (randf() - 0.5) * 10;
 						shapes[s].pos.y = (randf() - 0.5) * 10;
 						shapes[s].angle = randf() * 2*M_PI;
 					}
 					
-					for (int s0 = 0; s0 < 4; s0++) {
-						for (int s1 = 0; s1 < 4; s1++) {
+					for (int s0 = 0; s0 < 5; s0++) {
+						for (int s1 = 0; s1 < 5; s1++) {
 							shapes_are_overlapping(&shapes[s0], &shapes[s1]);
 						}
 					}
@@ -457,12 +927,69 @@ int main() {
 			print_test_result(amount.x == 0 && amount.y == 0);
 		}
 		
+		{
+			print_test_name("Huge polygons far from the origin overlap correctly");
+			const double scale = 100000;
+			vector<v2> huge_corners;
+			for (auto &corner : corners) huge_corners.push_back(corner * scale);
+			
+			Shape a, b;
+			try_make_polygon(huge_corners, &a);
+			try_make_polygon(huge_corners, &b);
+			double offset = -0.00198573451 * scale;
+			a.pos = v2(scale * 3, scale * 3 + offset);
+			b.pos = v2(scale * 3, scale * 3);
+			v2 amount = get_overlap_amount(&a, &b);
+			
+			double offset_amount_difference = fabs(amount.y) - (identical_polygons_width*scale - fabs(offset));
+			print_test_result(amount.x == 0 && amount.y > 0
+				&& offset_amount_difference > 0
+				&& offset_amount_difference < AMOUNT_TOLERANCE*scale);
+		}
+		
+		{
+			print_test_name("Capsule right of a polygon overlaps correctly");
+			Shape capsule;
+			try_make_capsule(v2(0, -1), v2(0, 1), 0.5, &capsule);
+			capsule.pos = v2(0.5, 0);
+			shape_b.pos = v2(0, 0);
+			v2 amount = get_overlap_amount(&capsule, &shape_b);
+			
+			double expected_amount = 0.1;
+			print_test_result(amount.x < 0 && fabs(amount.y) < AMOUNT_TOLERANCE
+				&& fabs(fabs(amount.x) - expected_amount) < AMOUNT_TOLERANCE);
+		}
+		
+		{
+			print_test_name("Circles overlap correctly");
+			Shape a, b;
+			make_circle(1, &a);
+			make_circle(0.5, &b);
+			a.pos = v2(0.6, 0.8);
+			b.pos = v2(0, 0);
+			v2 amount = get_overlap_amount(&a, &b);
+			print_test_result(fabs(amount.x - -0.3) < AMOUNT_TOLERANCE
+				&& fabs(amount.y - -0.4) < AMOUNT_TOLERANCE);
+		}
+		
+		{
+			print_test_name("Polygons with margins overlap like polygons without");
+			Shape a, b;
+			try_make_polygon_with_margin(corners, 0.02, &a);
+			try_make_polygon_with_margin(corners, 0.02, &b);
+			a.pos = shape_a.pos = v2(0.17, 0.03);
+			b.pos = shape_b.pos = v2(0, 0);
+			v2 amount = get_overlap_amount(&a, &b);
+			v2 expected_amount = get_overlap_amount(&shape_a, &shape_b);
+			print_test_result(amount.distance(expected_amount) < AMOUNT_TOLERANCE);
+		}
+		
 		{
 			print_test_name("Brute force test");
 			bool success = true;
 			
 			for (int outer = 0; outer < 30; outer++) {
-				Shape shapes[4];
+				Shape shapes[5];
 				
 				success = success && try_make_polygon({
 					v2(randf()-0.5, randf()-0.5),
@@ -477,16 +1004,18 @@ int main() {
 				
 				make_circle(randf()*3, &shapes[2]);
 				make_circle(randf()*3, &shapes[3]);
+				success = success && try_make_capsule(
+					v2(randf()-0.5, randf()-0.5), v2(randf()-0.5, randf()-0.5), randf(), &shapes[4]);
 				
 				for (int inner = 0; inner < 30; inner++) {
-					for (int s = 0; s < 4; s++) {
+					for (int s = 0; s < 5; s++) {
 						shapes[s].pos.x = (randf() - 0.5) * 10;
 						shapes[s].pos.y = (randf() - 0.5) * 10;
 						shapes[s].angle = randf() * 2*M_PI;
 					}
 					
-					for (int s0 = 0; s0 < 4; s0++) {
-						for (int s1 = 0; s1 < 4; s1++) {
+					for (int s0 = 0; s0 < 5; s0++) {
+						for (int s1 = 0; s1 < 5; s1++) {
 							get_overlap_amount(&shapes[s0], &shapes[s1]);
 						}
 					}
@@ -495,10 +1024,938 @@ int main() {
 			
 			print_test_result(success);
 		}
+		
+		{
+			print_test_name("Separating axis test agrees with EPA");
+			bool success = true;
+			
+			for (int outer = 0; outer < 30; outer++) {
+				Shape shapes[2];
+				for (int s = 0; s < 2; s++) {
+					// a random regular polygon with 2 (i.e. a segment) to 8 corners.
+					int corner_count = 2 + rand() % 7;
+					vector<v2> polygon_corners;
+					for (int c = 0; c < corner_count; c++) {
+						polygon_corners.push_back(v2(0.5, 0).rotated(c * 2*M_PI / corner_count));
+					}
+					success = success && (corner_count == 2
+						? try_make_segment(polygon_corners[0], polygon_corners[1], &shapes[s])
+						: try_make_polygon(polygon_corners, &shapes[s]));
+				}
+				
+				for (int inner = 0; inner < 30; inner++) {
+					for (int s = 0; s < 2; s++) {
+						shapes[s].pos.x = randf() - 0.5;
+						shapes[s].pos.y = randf() - 0.5;
+						shapes[s].angle = randf() * 2*M_PI;
+					}
+					
+					v2 sat_amount = get_overlap_amount(&shapes[0], &shapes[1]);
+					v2 epa_amount = get_epa_overlap_amount(&shapes[0], &shapes[1]);
+					
+					success = success && (sat_amount - epa_amount).length() < AMOUNT_TOLERANCE;
+				}
+			}
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Collinear segments that are apart don't overlap");
+			Shape segments[2];
+			try_make_segment(v2(0, 0), v2(1, 0), &segments[0]);
+			try_make_segment(v2(0, 0), v2(1, 0), &segments[1]);
+			segments[0].pos = v2(0, 0);
+			segments[1].pos = v2(3, 0);
+			segments[0].angle = segments[1].angle = 0;
+			
+			Status status;
+			bool success = get_overlap_amount(&segments[0], &segments[1], &status) == v2(0, 0)
+				&& status == STATUS_CONVERGED && !shapes_are_overlapping(&segments[0], &segments[1]);
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Box test agrees with GJK and EPA");
+			bool success = true;
+			
+			for (int outer = 0; outer < 30; outer++) {
+				Shape boxes[2], polygons[2];
+				for (int s = 0; s < 2; s++) {
+					double width = randf() + 0.01;
+					double height = randf() + 0.01;
+					success = success && try_make_box(width, height, &boxes[s]);
+					
+					// the same box, but as a plain polygon.
+					success = success && try_make_polygon({
+						v2(-width/2, -height/2), v2(width/2, -height/2), v2(width/2, height/2), v2(-width/2, height/2)
+					}, &polygons[s]);
+				}
+				
+				for (int inner = 0; inner < 30; inner++) {
+					for (int s = 0; s < 2; s++) {
+						boxes[s].pos = polygons[s].pos = v2(randf() - 0.5, randf() - 0.5);
+						boxes[s].angle = polygons[s].angle = randf() * 2*M_PI;
+					}
+					
+					v2 box_amount = get_overlap_amount(&boxes[0], &boxes[1]);
+					v2 epa_amount = get_epa_overlap_amount(&polygons[0], &polygons[1]);
+					success = success && fabs(box_amount.length() - epa_amount.length()) < AMOUNT_TOLERANCE;
+					
+					success = success && shapes_are_overlapping(&boxes[0], &boxes[1])
+						== shapes_are_overlapping(&polygons[0], &polygons[1]);
+					
+					// mix a box with a polygon to use the box's support function in GJK.
+					v2 mixed_amount = get_epa_overlap_amount(&boxes[0], &polygons[1]);
+					success = success && fabs(mixed_amount.length() - epa_amount.length()) < AMOUNT_TOLERANCE;
+				}
+			}
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Rotating a shape between queries");
+			Shape box_a, box_b;
+			try_make_polygon({ v2(-1, -0.1), v2(1, -0.1), v2(1, 0.1), v2(-1, 0.1) }, &box_a);
+			try_make_polygon({ v2(-1, -0.1), v2(1, -0.1), v2(1, 0.1), v2(-1, 0.1) }, &box_b);
+			box_a.pos = v2(0, 0);
+			box_a.angle = 0;
+			box_b.pos = v2(0, 0.5);
+			box_b.angle = 0;
+			bool success = !shapes_are_overlapping(&box_a, &box_b);
+			
+			// the cached cos and sin must follow the new angle.
+			box_a.angle = M_PI / 2;
+			success = success && shapes_are_overlapping(&box_a, &box_b);
+			
+			set_pose(&box_a, v2(0, 0), 0);
+			success = success && !shapes_are_overlapping(&box_a, &box_b);
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Local-space support agrees with rotating every corner");
+			Shape polygon;
+			try_make_polygon({ v2(-1, -0.5), v2(0.7, -0.8), v2(1.2, 0.3), v2(0.1, 1), v2(-0.9, 0.6) }, &polygon);
+			bool success = true;
+			for (int i = 0; i < 1000; i++) {
+				set_pose(&polygon, v2(randf() * 10 - 5, randf() * 10 - 5), randf() * 2*M_PI);
+				v2 direction = v2(randf() - 0.5, randf() - 0.5);
+				
+				double best_dot = -INFINITY;
+				for (int c = 0; c < polygon.corner_count; c++) {
+					v2 baked_corner = polygon.pos + polygon.corners[c].rotated(polygon.angle);
+					best_dot = fmax(best_dot, dot(baked_corner, direction));
+				}
+				
+				success = success && fabs(dot(get_baked_core_corner(&polygon, direction), direction) - best_dot) < 0.000001;
+			}
+			print_test_result(success);
+		}
 	} // end get_overlap_amount()
 	
+	printf("\nmax_gjk_iterations and max_epa_iterations:\n");
+	{
+		// squares would otherwise take the separating axis test, which these don't cover.
+		Shape shape_a, shape_b;
+		vector<v2> corners = { v2(-0.1, -0.1), v2(0.1, -0.1), v2(0.1, 0.1), v2(-0.1, 0.1) };
+		try_make_polygon(corners, &shape_a);
+		try_make_polygon(corners, &shape_b);
+		shape_a.pos = v2(0.05, 0.02);
+		shape_b.pos = v2(0, 0);
+		
+		{
+			print_test_name("Uncapped query converges");
+			Status status;
+			v2 amount = get_epa_overlap_amount(&shape_a, &shape_b, &status);
+			print_test_result(status == STATUS_CONVERGED && amount.distance(v2(-0.15, 0)) < 0.000001);
+		}
+		
+		{
+			print_test_name("GJK iteration cap is reported");
+			int old_max_gjk_iterations = max_gjk_iterations;
+			max_gjk_iterations = 1;
+			Status status;
+			bool overlapping = shapes_are_overlapping(&shape_a, &shape_b, &status);
+			max_gjk_iterations = old_max_gjk_iterations;
+			print_test_result(overlapping && status == STATUS_HIT_ITERATION_CAP);
+		}
+		
+		{
+			print_test_name("EPA iteration cap gives a best guess");
+			int old_max_epa_iterations = max_epa_iterations;
+			max_epa_iterations = 0;
+			Status status;
+			shape_a.pos = v2(0.05, 0.02);
+			v2 amount = get_epa_overlap_amount(&shape_a, &shape_b, &status);
+			max_epa_iterations = old_max_epa_iterations;
+			print_test_result(status == STATUS_HIT_ITERATION_CAP && !amount.is_0());
+		}
+		
+		{
+			print_test_name("Touching shapes are degenerate");
+			Status status;
+			shape_a.pos = v2(0.2, 0);
+			get_epa_overlap_amount(&shape_a, &shape_b, &status);
+			print_test_result(status == STATUS_DEGENERATE);
+		}
+	}
+	
+	printf("\nExact side tests:\n");
+	{
+		// a is within a few ulps of the line through b and c, on the side given by j - i.
+		print_test_name("Orientation of nearly collinear points");
+		bool success = true;
+		double ulp = DBL_EPSILON / 2;
+		for (int i = 0; i < 64; i++) {
+			for (int j = 0; j < 64; j++) {
+				v2 a = v2(0.5 + i*ulp, 0.5 + j*ulp);
+				int expected = j > i ? 1 : j < i ? -1 : 0;
+				success = success && get_orientation(a, v2(12, 12), v2(24, 24)) == expected
+					&& get_orientation(v2(12, 12), v2(24, 24), a) == expected;
+			}
+		}
+		print_test_result(success);
+	}
+	
+	{
+		// integer coordinates, so that the differences are exact but their products can round.
+		print_test_name("Sign of nearly perpendicular dot products");
+		bool success = true;
+		for (int t = 0; t < 10000; t++) {
+			long long p = rand() % (1 << 27);
+			long long q = rand() % (1 << 27);
+			long long k = rand() % 5 - 2;
+			v2 from = v2(rand() % (1 << 27), rand() % (1 << 27));
+			v2 a = from + v2(p, q);
+			v2 b = from + v2(q + k, -p);
+			long long exact = p*(q + k) - q*p;
+			success = success && get_sign_of_dot(from, a, b) == (exact > 0 ? 1 : exact < 0 ? -1 : 0);
+		}
+		print_test_result(success);
+	}
+	
+	{
+		print_test_name("Origin between points, exactly");
+		// improve_2_simplex() only keeps both points, or finds the origin on the line, when it's between them.
+		auto origin_is_between_points = [](v2 a, v2 b) {
+			vector<v2> simplex = { a, b };
+			v2 search_direction;
+			return improve_2_simplex(simplex, search_direction, 0) || simplex.size() == 2;
+		};
+		double ulp = DBL_EPSILON;
+		bool success = origin_is_between_points(v2(0, -1), v2(0, 1))
+			&& origin_is_between_points(v2(0, 0), v2(1, 1))
+			&& origin_is_between_points(v2(-1 + ulp, 1e-300), v2(1, 1e-300))
+			&& !origin_is_between_points(v2(ulp, 1), v2(1, 1))
+			&& !origin_is_between_points(v2(1e-300, 1e-300), v2(1, 1));
+		print_test_result(success);
+	}
+	
+	{
+		print_test_name("Touching shapes far from the origin converge");
+		bool success = true;
+		for (int t = 0; t < 1000; t++) {
+			Shape shape_a, shape_b;
+			try_make_box(1 + randf(), 1 + randf(), &shape_a);
+			try_make_box(1 + randf(), 1 + randf(), &shape_b);
+			v2 far_away = v2(randf() - 0.5, randf() - 0.5) * 1e7;
+			shape_a.pos = far_away;
+			shape_b.pos = far_away + v2(shape_a.half_size.x + shape_b.half_size.x, randf() - 0.5);
+			shape_a.angle = shape_b.angle = 0;
+			
+			for (int order = 0; order < 2; order++) {
+				Status status;
+				if (order == 0) shapes_are_overlapping(&shape_a, &shape_b, &status);
+				else shapes_are_overlapping(&shape_b, &shape_a, &status);
+				success = success && status != STATUS_HIT_ITERATION_CAP;
+			}
+		}
+		print_test_result(success);
+	}
+	
+	printf("\nget_stats():\n");
+	{
+		// squares would otherwise take the separating axis test, which these don't cover.
+		Shape shape_a, shape_b;
+		vector<v2> corners = { v2(-0.1, -0.1), v2(0.1, -0.1), v2(0.1, 0.1), v2(-0.1, 0.1) };
+		try_make_polygon(corners, &shape_a);
+		try_make_polygon(corners, &shape_b);
+		shape_a.pos = v2(0.05, 0.02);
+		shape_b.pos = v2(0, 0);
+		
+		{
+			print_test_name("Counters are zero after reset");
+			reset_stats();
+			Stats stats = get_stats();
+			print_test_result(stats.gjk_iterations == 0 && stats.epa_iterations == 0
+				&& stats.support_calls == 0 && stats.degenerate_cases == 0 && stats.allocations == 0);
+		}
+		
+		{
+			print_test_name("Counters count an overlap query");
+			reset_stats();
+			get_epa_overlap_amount(&shape_a, &shape_b);
+			Stats stats = get_stats();
+			print_test_result(stats.gjk_iterations > 0 && stats.epa_iterations > 0
+				&& stats.support_calls >= stats.gjk_iterations + stats.epa_iterations);
+		}
+		
+		{
+			print_test_name("Repeated queries don't allocate");
+			get_epa_overlap_amount(&shape_a, &shape_b);
+			reset_stats();
+			get_epa_overlap_amount(&shape_a, &shape_b);
+			shapes_are_overlapping(&shape_a, &shape_b);
+			print_test_result(get_stats().allocations == 0);
+		}
+		
+		{
+			print_test_name("Caller-provided workspace gives the same answer");
+			Workspace workspace;
+			v2 amount = get_epa_overlap_amount(&shape_a, &shape_b, nullptr, &workspace);
+			print_test_result(amount == get_epa_overlap_amount(&shape_a, &shape_b) && workspace.simplex.capacity() > 0);
+		}
+		
+		{
+			print_test_name("Origin on a simplex line counts as degenerate");
+			reset_stats();
+			shape_a.pos = v2(0, 0);
+			shapes_are_overlapping(&shape_a, &shape_b);
+			print_test_result(get_stats().degenerate_cases > 0);
+		}
+	}
+	
+	printf("\nwrite_trace():\n");
+	{
+		// only a traced build records spans. Otherwise the trace is an empty array.
+		print_test_name("Writes each thread's spans as a Chrome trace");
+		Shape shape_a, shape_b;
+		make_circle(1, &shape_a);
+		try_make_box(1, 1, &shape_b);
+		shape_a.pos = v2(0.5, 0.5);
+		shape_b.pos = v2(0, 0);
+		clear_trace();
+		for_each_index_in_parallel(2, 2, [&](int i) {
+			Shape a = shape_a, b = shape_b;
+			get_overlap_amount(&a, &b);
+		});
+		
+		FILE *file = tmpfile();
+		write_trace(file);
+		write_trace(file);
+		finish_trace();
+		string trace(ftell(file), '\0');
+		rewind(file);
+		bool success = fread(&trace[0], 1, trace.size(), file) == trace.size();
+		fclose(file);
+		
+		auto count_occurrences = [&](string text) {
+			int count = 0;
+			for (size_t at = trace.find(text); at != string::npos; at = trace.find(text, at + 1)) count++;
+			return count;
+		};
+		#ifdef RW_GJK_TRACE
+			success = success && trace.compare(0, 2, "[\n") == 0 && count_occurrences("[") == 1
+				&& count_occurrences("\"name\":\"EPA\"") == 2 && count_occurrences("\"name\":\"parallel part\"") == 2
+				&& count_occurrences("\"tid\":") == count_occurrences("\"dur\":");
+		#else
+			success = success && trace == "[\n";
+		#endif
+		print_test_result(success);
+	}
+	
+	#ifdef RW_GJK_HAS_MMAP
+	{
+		print_test_name("Opens the array once down a pipe");
+		clear_trace();
+		int pipe_ends[2];
+		bool success = pipe(pipe_ends) == 0;
+		FILE *writer = fdopen(pipe_ends[1], "w");
+		write_trace(writer);
+		write_trace(writer);
+		finish_trace();
+		fclose(writer);
+		
+		string trace;
+		char buffer[256];
+		for (ssize_t count; (count = read(pipe_ends[0], buffer, sizeof(buffer))) > 0; ) trace.append(buffer, count);
+		close(pipe_ends[0]);
+		print_test_result(success && trace == "[\n");
+	}
+	#endif
+	
+	printf("\nbundled_sin_cos():\n");
+	{
+		print_test_name("Agrees with libm to about an ulp");
+		bool success = true;
+		for (int a = 0; a < 1000; a++) {
+			double angle = a * 0.37 - 185;
+			double s, c;
+			bundled_sin_cos(angle, &s, &c);
+			success = success && fabs(s - sin(angle)) <= 2.3e-16 && fabs(c - cos(angle)) <= 2.3e-16;
+		}
+		print_test_result(success);
+	}
+	
+	{
+		print_test_name("Copes with huge and non-finite angles");
+		bool success = true;
+		for (double angle : { 1e10, -3e15, 1e300, -DBL_MAX, (double)FLT_MAX }) {
+			double s, c;
+			bundled_sin_cos(angle, &s, &c);
+			success = success && fabs(s*s + c*c - 1) < 1e-15;
+		}
+		for (double angle : { (double)NAN, (double)INFINITY, -(double)INFINITY }) {
+			double s, c;
+			bundled_sin_cos(angle, &s, &c);
+			success = success && isnan(s) && isnan(c);
+		}
+		print_test_result(success);
+	}
+	
+	// only deterministic builds promise the same bits everywhere.
+	#ifdef RW_GJK_DETERMINISTIC
+		{
+			// if this fails, the compiler has probably fused multiplies and adds. Build with -ffp-contract=off.
+			print_test_name("Gives the same bits as on every other build");
+			uint64_t hash = 1469598103934665603ull;
+			for (int a = 0; a < 1000; a++) {
+				double s, c;
+				bundled_sin_cos(a * 0.37 - 185, &s, &c);
+				for (double result : { s, c }) {
+					uint64_t bits;
+					memcpy(&bits, &result, sizeof(bits));
+					hash = (hash ^ bits) * 1099511628211ull;
+				}
+			}
+			double s, c;
+			bundled_sin_cos(0, &s, &c);
+			print_test_result(hash == 0xe19065bbdc17c220ull && s == 0 && c == 1);
+		}
+	#endif
+	
+	{
+		print_test_name("Corners are sorted in the same order as by atan2()");
+		bool success = true;
+		mt19937 shuffler(rand());
+		for (int p = 0; p < 100; p++) {
+			vector<v2> corners;
+			for (int c = 0; c < 3 + p % 8; c++) corners.push_back(v2(1, 0).rotated(randf() * 2*M_PI) * (1 + randf()));
+			shuffle(corners.begin(), corners.end(), shuffler);
+			
+			vector<v2> sorted = corners;
+			sort_corners_around_centre(sorted);
+			v2 centre = ORIGIN;
+			for (auto &corner : corners) centre = centre + corner / corners.size();
+			for (int c = 0; c+1 < sorted.size(); c++) {
+				success = success && atan2(sorted[c].y - centre.y, sorted[c].x - centre.x) <= atan2(sorted[c+1].y - centre.y, sorted[c+1].x - centre.x);
+			}
+		}
+		print_test_result(success);
+	}
+	
+	printf("\nWorld:\n");
+	{
+		Shape square, circle;
+		try_make_polygon({ v2(-0.5, -0.5), v2(0.5, -0.5), v2(0.5, 0.5), v2(-0.5, 0.5) }, &square);
+		make_circle(0.5, &circle);
+		
+		auto count_events = [](const vector<Overlap_event> &events, Overlap_event_type type) {
+			int count = 0;
+			for (auto &event : events) count += event.type == type;
+			return count;
+		};
+		
+		{
+			print_test_name("Begin, persist and end events");
+			World world;
+			Shape_handle moving = world.add_shape(circle);
+			world.add_shape(square);
+			world.get_shape(moving)->pos = v2(-3, 0);
+			
+			bool success = world.step().empty();
+			world.get_shape(moving)->pos = v2(-0.9, 0);
+			auto events = world.step();
+			success = success && events.size() == 1 && events[0].type == OVERLAP_BEGIN
+				&& (events[0].shape_a == moving || events[0].shape_b == moving);
+			world.get_shape(moving)->pos = v2(-0.8, 0);
+			events = world.step();
+			success = success && events.size() == 1 && events[0].type == OVERLAP_PERSIST;
+			
+			// still near enough to be a candidate, but no longer touching.
+			world.get_shape(moving)->pos = v2(-1.05, 0.01);
+			events = world.step();
+			success = success && events.size() == 1 && events[0].type == OVERLAP_END;
+			
+			// and when the broadphase drops the pair straight away.
+			world.get_shape(moving)->pos = v2(-0.9, 0);
+			world.step();
+			world.get_shape(moving)->pos = v2(-10, 0);
+			events = world.step();
+			success = success && events.size() == 1 && events[0].type == OVERLAP_END;
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Removing a shape ends its overlaps");
+			World world;
+			Shape_handle removed = world.add_shape(circle);
+			Shape_handle kept = world.add_shape(square);
+			bool success = world.step().size() == 1;
+			
+			world.remove_shape(removed);
+			auto events = world.step();
+			success = success && events.size() == 1 && events[0].type == OVERLAP_END
+				&& (events[0].shape_a == removed || events[0].shape_b == removed);
+			
+			// the old handle doesn't refer to a new shape in the same slot.
+			Shape_handle added = world.add_shape(circle);
+			success = success && !world.is_valid(removed) && world.get_shape(removed) == nullptr
+				&& world.is_valid(added) && world.is_valid(kept) && added != removed;
+			success = success && count_events(world.step(), OVERLAP_BEGIN) == 1;
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Old handles stay invalid however often their slot is reused");
+			World world;
+			Shape_handle first = world.add_shape(circle);
+			world.remove_shape(first);
+			Shape_handle live = NO_SHAPE;
+			bool success = true;
+			for (int cycle = 0; cycle < 1000; cycle++) {
+				live = world.add_shape(circle);
+				success = success && !world.is_valid(first) && live != first;
+				if (cycle < 999) world.remove_shape(live);
+			}
+			success = success && world.is_valid(live);
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("A reused slot doesn't inherit the old shape's overlaps");
+			World world;
+			Shape_handle removed = world.add_shape(circle);
+			Shape_handle kept = world.add_shape(square);
+			world.step();
+			
+			// the new shape takes the removed shape's slot before the next step, and overlaps too.
+			world.remove_shape(removed);
+			Shape_handle added = world.add_shape(circle);
+			auto events = world.step();
+			bool success = events.size() == 2 && count_events(events, OVERLAP_END) == 1 && count_events(events, OVERLAP_BEGIN) == 1;
+			for (auto &event : events) {
+				Shape_handle other = event.shape_a == kept ? event.shape_b : event.shape_a;
+				success = success && other == (event.type == OVERLAP_END ? removed : added);
+			}
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Pairs that haven't moved aren't tested again");
+			World world;
+			world.add_shape(circle);
+			Shape_handle moving = world.add_shape(square);
+			world.get_shape(moving)->pos = v2(0.3, 0);
+			world.step();
+			
+			reset_stats();
+			auto events = world.step();
+			bool success = get_stats().support_calls == 0 && events.size() == 1 && events[0].type == OVERLAP_PERSIST;
+			
+			world.get_shape(moving)->angle = 0.1;
+			events = world.step();
+			success = success && get_stats().support_calls > 0 && events.size() == 1 && events[0].type == OVERLAP_PERSIST;
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Agrees with shapes_are_overlapping() over many steps");
+			World world;
+			vector<Shape_handle> handles;
+			for (int s = 0; s < 40; s++) {
+				Shape shape;
+				if (s % 3 == 0) make_circle(0.2 + randf() * 0.3, &shape);
+				else try_make_polygon({ v2(-0.3, -0.2), v2(0.3, -0.3), v2(0.2, 0.3) }, &shape);
+				handles.push_back(world.add_shape(shape));
+			}
+			
+			bool success = true;
+			int overlapping_count = 0;
+			for (int step = 0; step < 20; step++) {
+				for (auto handle : handles) {
+					Shape *shape = world.get_shape(handle);
+					shape->pos = step == 0 ? v2(randf() * 5, randf() * 5) : shape->pos + v2(randf() - 0.5, randf() - 0.5) * 0.2;
+					shape->angle += randf() - 0.5;
+				}
+				
+				auto events = world.step();
+				int expected_count = 0;
+				for (int a = 0; a < handles.size(); a++) {
+					for (int b = a+1; b < handles.size(); b++) {
+						expected_count += shapes_are_overlapping(world.get_shape(handles[a]), world.get_shape(handles[b]));
+					}
+				}
+				
+				overlapping_count += count_events(events, OVERLAP_BEGIN) - count_events(events, OVERLAP_END);
+				success = success && overlapping_count == expected_count
+					&& count_events(events, OVERLAP_BEGIN) + count_events(events, OVERLAP_PERSIST) == expected_count;
+			}
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Static shapes pair with dynamic shapes but not each other");
+			World world;
+			vector<Shape_handle> static_handles, dynamic_handles;
+			for (int s = 0; s < 200; s++) {
+				Shape shape;
+				try_make_polygon({ v2(-0.3, -0.2), v2(0.3, -0.3), v2(0.2, 0.3) }, &shape);
+				shape.pos = v2(randf() * 5, randf() * 5);
+				shape.angle = randf() * 2*M_PI;
+				if (s % 4 == 0) dynamic_handles.push_back(world.add_shape(shape));
+				else static_handles.push_back(world.add_shape(shape, true));
+			}
+			
+			bool success = true;
+			for (int step = 0; step < 10; step++) {
+				for (auto handle : dynamic_handles) {
+					Shape *shape = world.get_shape(handle);
+					shape->pos = shape->pos + v2(randf() - 0.5, randf() - 0.5) * 0.3;
+				}
+				if (step == 5) {
+					world.remove_shape(static_handles.back());
+					static_handles.pop_back();
+				}
+				
+				int expected_count = 0;
+				for (int a = 0; a < dynamic_handles.size(); a++) {
+					for (int b = a+1; b < dynamic_handles.size(); b++) {
+						expected_count += shapes_are_overlapping(world.get_shape(dynamic_handles[a]), world.get_shape(dynamic_handles[b]));
+					}
+					for (auto static_handle : static_handles) {
+						expected_count += shapes_are_overlapping(world.get_shape(dynamic_handles[a]), world.get_shape(static_handle));
+					}
+				}
+				
+				int count = 0;
+				for (auto &event : world.step()) {
+					if (event.type == OVERLAP_END) continue;
+					count++;
+					success = success && !(find(static_handles.begin(), static_handles.end(), event.shape_a) != static_handles.end()
+						&& find(static_handles.begin(), static_handles.end(), event.shape_b) != static_handles.end());
+				}
+				success = success && count == expected_count;
+			}
+			
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Islands that keep still fall asleep");
+			World world;
+			world.steps_until_sleep = 10;
+			Shape ground;
+			try_make_box(10, 1, &ground);
+			Shape_handle ground_handle = world.add_shape(ground, true);
+			Shape_handle lower = world.add_shape(square);
+			Shape_handle upper = world.add_shape(square);
+			world.get_shape(lower)->pos = v2(0, 0.9);
+			world.get_shape(upper)->pos = v2(0.2, 1.8);
+			
+			for (int step = 0; step < 10; step++) world.step();
+			bool success = !world.is_asleep(lower) && !world.is_asleep(upper);
+			world.step();
+			success = success && world.is_asleep(lower) && world.is_asleep(upper);
+			
+			// sleeping pairs aren't tested, but still persist.
+			reset_stats();
+			auto events = world.step();
+			success = success && get_stats().support_calls == 0 && count_events(events, OVERLAP_PERSIST) == 2
+				&& events.size() == 2;
+			
+			print_test_result(success);
+			
+			print_test_name("Moving a sleeping shape wakes its island");
+			world.get_shape(upper)->pos = v2(0.25, 1.8);
+			events = world.step();
+			success = !world.is_asleep(lower) && !world.is_asleep(upper) && count_events(events, OVERLAP_PERSIST) == 2;
+			print_test_result(success);
+			
+			print_test_name("Running into a sleeping island wakes it");
+			for (int step = 0; step < 12; step++) world.step();
+			success = world.is_asleep(lower) && world.is_asleep(upper);
+			Shape_handle intruder = world.add_shape(circle);
+			world.get_shape(intruder)->pos = v2(-3, 3);
+			world.step();
+			success = success && world.is_asleep(upper);
+			world.get_shape(intruder)->pos = v2(0.5, 2.6);
+			events = world.step();
+			success = success && count_events(events, OVERLAP_BEGIN) == 1;
+			world.step();
+			success = success && !world.is_asleep(upper) && !world.is_asleep(lower);
+			print_test_result(success);
+			
+			print_test_name("Moving a static shape away from a sleeping island wakes it");
+			for (int step = 0; step < 12; step++) world.step();
+			success = world.is_asleep(lower);
+			world.get_shape(ground_handle)->pos = v2(0, -10);
+			events = world.step();
+			success = success && !world.is_asleep(lower) && count_events(events, OVERLAP_END) == 1
+				&& count_events(events, OVERLAP_PERSIST) == 2;
+			print_test_result(success);
+			
+			print_test_name("Adding a static shape onto a sleeping island wakes it");
+			for (int step = 0; step < 12; step++) world.step();
+			success = world.is_asleep(lower);
+			ground.pos = v2(0, 0);
+			Shape_handle new_ground = world.add_shape(ground, true);
+			events = world.step();
+			success = success && !world.is_asleep(lower) && count_events(events, OVERLAP_BEGIN) == 1;
+			print_test_result(success);
+			
+			print_test_name("Removing a static shape under a sleeping island wakes it");
+			for (int step = 0; step < 12; step++) world.step();
+			success = world.is_asleep(lower);
+			world.remove_shape(new_ground);
+			events = world.step();
+			success = success && !world.is_asleep(lower) && count_events(events, OVERLAP_END) == 1;
+			print_test_result(success);
+		}
+		
+		// a crowd of circles piled on top of each other, half of them inside a static box.
+		auto make_crowd = [&](World *world_out, vector<Shape_handle> *handles_out) {
+			Shape box;
+			try_make_box(2, 2, &box);
+			handles_out->push_back(world_out->add_shape(box, true));
+			for (int s = 0; s < 60; s++) {
+				Shape agent;
+				make_circle(0.3, &agent);
+				agent.pos = v2((s % 10) * 0.2, (s / 10) * 0.2);
+				handles_out->push_back(world_out->add_shape(agent));
+			}
+			world_out->step();
+		};
+		auto get_deepest_overlap = [](World *world, const vector<Shape_handle> &handles) {
+			double deepest = 0;
+			for (int a = 0; a < handles.size(); a++) {
+				for (int b = a+1; b < handles.size(); b++) {
+					deepest = fmax(deepest, get_overlap_amount(world->get_shape(handles[a]), world->get_shape(handles[b])).length());
+				}
+			}
+			return deepest;
+		};
+		
+		for (auto method : { SOLVER_GAUSS_SEIDEL, SOLVER_JACOBI }) {
+			print_test_name(method == SOLVER_JACOBI ? "Jacobi solver pushes a crowd apart" : "Gauss-Seidel solver pushes a crowd apart");
+			World world;
+			vector<Shape_handle> handles;
+			make_crowd(&world, &handles);
+			double deepest_before = get_deepest_overlap(&world, handles);
+			
+			Solver_settings settings;
+			settings.method = method;
+			settings.max_iterations = 200;
+			settings.convergence_threshold = 0.001;
+			for (int step = 0; step < 10; step++) {
+				world.resolve_overlaps(settings);
+				world.step();
+			}
+			
+			bool success = deepest_before > 0.5 && get_deepest_overlap(&world, handles) < 0.02
+				&& world.get_shape(handles[0])->pos == v2(0, 0);
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Solver stops at the iteration budget, or once converged");
+			World world;
+			vector<Shape_handle> handles;
+			make_crowd(&world, &handles);
+			Solver_settings settings;
+			settings.max_iterations = 3;
+			Solver_result result = world.resolve_overlaps(settings);
+			bool success = result.iterations == 3 && !result.converged && result.largest_correction > settings.convergence_threshold;
+			
+			World apart;
+			Shape agent;
+			make_circle(0.5, &agent);
+			Shape_handle left = apart.add_shape(agent);
+			agent.pos = v2(0.9, 0);
+			apart.add_shape(agent);
+			apart.step();
+			settings.max_iterations = 100;
+			result = apart.resolve_overlaps(settings);
+			success = success && result.converged && result.iterations > 1 && result.iterations < 100;
+			
+			apart.get_shape(left)->pos = v2(-5, 0);
+			apart.step();
+			result = apart.resolve_overlaps(settings);
+			success = success && result.converged && result.iterations == 0;
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Jacobi solver gives the same result on several threads");
+			World one_thread, four_threads;
+			vector<Shape_handle> handles, other_handles;
+			make_crowd(&one_thread, &handles);
+			make_crowd(&four_threads, &other_handles);
+			for (int h = 0; h < handles.size(); h++) {
+				// turned since the step, so the solver has to refresh the rotations before sharing the shapes.
+				one_thread.get_shape(handles[h])->angle = h * 0.1f;
+				four_threads.get_shape(other_handles[h])->angle = h * 0.1f;
+			}
+			Solver_settings settings;
+			settings.method = SOLVER_JACOBI;
+			one_thread.resolve_overlaps(settings);
+			settings.thread_count = 4;
+			four_threads.resolve_overlaps(settings);
+			
+			bool success = true;
+			for (int h = 0; h < handles.size(); h++) {
+				success = success && one_thread.get_shape(handles[h])->pos == four_threads.get_shape(other_handles[h])->pos;
+			}
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Solver and swept events don't depend on the pair cache's history");
+			World fresh, churned;
+			vector<Shape_handle> handles, other_handles;
+			make_crowd(&fresh, &handles);
+			make_crowd(&churned, &other_handles);
+			
+			// a second crowd far away grows the churned world's pair cache, then leaves it.
+			vector<Shape_handle> visitors;
+			for (int s = 0; s < 200; s++) {
+				Shape visitor;
+				make_circle(0.5, &visitor);
+				visitor.pos = v2(100 + (s % 20) * 0.1, (s / 20) * 0.1);
+				visitors.push_back(churned.add_shape(visitor));
+			}
+			churned.step();
+			for (auto visitor : visitors) churned.remove_shape(visitor);
+			const vector<Overlap_event> &events = churned.step();
+			fresh.step();
+			fresh.step();
+			
+			bool success = count_events(events, OVERLAP_END) > 1000;
+			for (int e = 1; e < events.size(); e++) {
+				if (events[e-1].type != OVERLAP_END || events[e].type != OVERLAP_END) continue;
+				auto slots_of = [](const Overlap_event &event) {
+					return make_pair(event.shape_b & UINT32_MAX, event.shape_a & UINT32_MAX);
+				};
+				success = success && slots_of(events[e-1]) < slots_of(events[e]);
+			}
+			
+			fresh.resolve_overlaps();
+			churned.resolve_overlaps();
+			for (int h = 0; h < handles.size(); h++) {
+				success = success && fresh.get_shape(handles[h])->pos == churned.get_shape(other_handles[h])->pos;
+			}
+			print_test_result(success);
+		}
+		
+		{
+			print_test_name("Static_bvh finds tied items in the same order however they're given");
+			// a row of shapes stacked in pairs, so that half of the split coordinates are tied.
+			vector<Static_bvh::Item> items;
+			for (int i = 0; i < 64; i++) items.push_back({ { v2(i / 2, 0), v2(i / 2 + 1, 1) }, i });
+			
+			vector<int> first_order;
+			bool success = true;
+			mt19937 shuffler(rand());
+			for (int attempt = 0; attempt < 10; attempt++) {
+				shuffle(items.begin(), items.end(), shuffler);
+				Static_bvh bvh;
+				bvh.build(items);
+				vector<int> found;
+				bvh.query({ v2(-1, -1), v2(100, 2) }, [&](int id) { found.push_back(id); });
+				if (attempt == 0) first_order = found;
+				success = success && found.size() == 64 && found == first_order;
+			}
+			print_test_result(success);
+		}
+		
+		#ifdef RW_GJK_DETERMINISTIC
+		{
+			// if this fails, the compiler has probably fused multiplies and adds. Build with -ffp-contract=off, and on GCC with -fno-tree-slp-vectorize.
+			print_test_name("Queries and the solver give the same bits as on every other build");
+			uint64_t hash = 1469598103934665603ull;
+			auto hash_double = [&](double value) {
+				uint64_t bits;
+				memcpy(&bits, &value, sizeof(bits));
+				hash = (hash ^ bits) * 1099511628211ull;
+			};
+			
+			// mt19937's raw output is fixed by the standard, unlike rand()'s and the distributions'.
+			mt19937 engine(2018);
+			auto next_double = [&]() { return engine() / 4294967296.0; };
+			auto make_regular_polygon = [](int corner_count, double radius, double rounding, Shape *shape_out) {
+				vector<v2> corners;
+				for (int c = 0; c < corner_count; c++) {
+					double s, co;
+					bundled_sin_cos(c * 6.283185307179586 / corner_count, &s, &co);
+					corners.push_back(v2(co, s) * radius);
+				}
+				return try_make_rounded_polygon(corners, rounding, shape_out);
+			};
+			
+			// one of each kind of shape, so that every query path is covered.
+			vector<Shape> kinds(7);
+			bool success = make_regular_polygon(3, 0.5, 0, &kinds[0]) && make_regular_polygon(6, 0.4, 0, &kinds[1])
+				&& make_regular_polygon(12, 0.5, 0, &kinds[2]) && make_regular_polygon(5, 0.3, 0.1, &kinds[3])
+				&& try_make_box(0.8, 0.3, &kinds[4]) && try_make_capsule(v2(0, -0.3), v2(0, 0.3), 0.2, &kinds[5]);
+			make_circle(0.35, &kinds[6]);
+			
+			for (int q = 0; q < 2000; q++) {
+				Shape a = kinds[engine() % kinds.size()];
+				Shape b = kinds[engine() % kinds.size()];
+				a.pos = v2(next_double(), next_double());
+				b.pos = v2(next_double(), next_double());
+				a.angle = float(next_double() * 7);
+				b.angle = float(next_double() * 7);
+				hash_double(shapes_are_overlapping(&a, &b));
+				v2 amount = get_overlap_amount(&a, &b);
+				hash_double(amount.x);
+				hash_double(amount.y);
+			}
+			
+			for (auto method : { SOLVER_GAUSS_SEIDEL, SOLVER_JACOBI }) {
+				World world;
+				vector<Shape_handle> handles;
+				for (int s = 0; s < 40; s++) {
+					Shape shape = kinds[s % kinds.size()];
+					shape.pos = v2(next_double() * 2, next_double() * 2);
+					shape.angle = float(next_double() * 7);
+					handles.push_back(world.add_shape(shape, s % 10 == 0));
+				}
+				Solver_settings settings;
+				settings.method = method;
+				for (int step = 0; step < 5; step++) {
+					for (auto &event : world.step()) hash_double(event.type + 3 * (event.shape_a + 64 * event.shape_b));
+					world.resolve_overlaps(settings);
+				}
+				for (auto handle : handles) {
+					hash_double(world.get_shape(handle)->pos.x);
+					hash_double(world.get_shape(handle)->pos.y);
+				}
+			}
+			
+			print_test_result(success && hash == 0x6ca391a9413d1c6aull);
+		}
+		#endif
+	}
+	
 	printf("\nNumber of failed tests: %i\n\n", num_failed_tests);
-	return 0;
+	return num_failed_tests == 0 ? 0 : 1;
 }
 
 
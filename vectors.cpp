@@ -1,8 +1,8 @@
 struct v2 {
 	double x, y;
 	
-	v2();
-	v2(double x_, double y_);
+	constexpr v2();
+	constexpr v2(double x_, double y_);
 	
 	double length() const;
 	double distance(const v2 &) const;
@@ -11,37 +11,79 @@ struct v2 {
 	v2 right_normal_or_0() const;
 	v2 normal_in_direction_or_0(v2 direction) const;
 	v2 rotated(double radians) const;
+	v2 rotated(double radians_cos, double radians_sin) const;
+	v2 unrotated(double radians_cos, double radians_sin) const;
 	
 	bool operator==(const v2 &) const;
 	bool operator!=(const v2 &rh) const;
-	v2 operator+(const v2 &) const;
-	v2 operator-(const v2 &) const;
-	v2 operator-() const;
-	v2 operator*(const double &) const;
-	v2 operator/(const double &) const;
+	constexpr v2 operator+(const v2 &) const;
+	constexpr v2 operator-(const v2 &) const;
+	constexpr v2 operator-() const;
+	constexpr v2 operator*(const double &) const;
+	constexpr v2 operator/(const double &) const;
 };
 
-double dot(const v2 &a, const v2 &b) {
-	return a.x*b.x + a.y*b.y;
+/*
+sin and cos of the same angle, worked out with nothing but +, -, * and conversions to integers,
+which IEEE 754 defines to the bit. libm's sin() and cos() aren't, so they can differ between compilers and
+platforms. It's accurate to about an ulp for any angle a game would use, and loses accuracy (but
+not determinism) past about a million radians.
+*/
+void bundled_sin_cos(double radians, double *sin_out, double *cos_out) {
+	// pi/2 split into a part with few enough bits that quadrant*PI_OVER_2_HIGH is exact, and the rest.
+	const double TWO_OVER_PI = 6.36619772367581382433e-01;
+	const double PI_OVER_2_HIGH = 1.57079632673412561417e+00;
+	const double PI_OVER_2_LOW = 6.07710050650619224932e-11;
+	
+	// converting the quadrant to an integer is undefined for NANs, infinities and angles too big to fit,
+	// so huge angles are brought back round first. fmod() is exact, so that's deterministic too.
+	if (!(fabs(radians) <= DBL_MAX)) {
+		*sin_out = *cos_out = NAN; // like libm.
+		return;
+	}
+	if (fabs(radians) > 1e9) radians = fmod(radians, 6.28318530717958647692);
+	
+	long long quadrant_index = (long long)(radians * TWO_OVER_PI + (radians < 0 ? -0.5 : 0.5));
+	double quadrant = double(quadrant_index);
+	double r = (radians - quadrant * PI_OVER_2_HIGH) - quadrant * PI_OVER_2_LOW; // in [-pi/4, pi/4]
+	
+	// fdlibm's minimax polynomials for that range.
+	double z = r * r;
+	double sin_r = r + r * z * (-1.66666666666666324348e-01 + z * (8.33333333332248946124e-03
+		+ z * (-1.98412698298579493134e-04 + z * (2.75573137070700676789e-06
+		+ z * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10)))));
+	double cos_r = 1 - 0.5 * z + z * z * (4.16666666666666019037e-02 + z * (-1.38888888888741095749e-03
+		+ z * (2.48015872894767294178e-05 + z * (-2.75573143513906633035e-07
+		+ z * (2.08757232129817482790e-09 + z * -1.13596475577881948265e-11)))));
+	
+	// selects rather than branches, since the quadrant of an arbitrary angle is unpredictable.
+	int q = int(quadrant_index & 3);
+	bool is_odd = q & 1;
+	*sin_out = (is_odd ? cos_r : sin_r) * (q & 2 ? -1 : 1);
+	*cos_out = (is_odd ? sin_r : cos_r) * ((q + 1) & 2 ? -1 : 1);
 }
 
-v2::v2() {
-	// These are NANs at the moment to catch uninitialised-variable bugs
-	x = NAN;
-	y = NAN;
+constexpr double dot(const v2 &a, const v2 &b) {
+	return a.x*b.x + a.y*b.y;
 }
 
-v2::v2(double x_, double y_) {
-	x = x_;
-	y = y_;
+// The z component of the 3D cross product, i.e. positive when b is anticlockwise of a.
+constexpr double cross(const v2 &a, const v2 &b) {
+	return a.x*b.y - a.y*b.x;
 }
 
+// These are NANs at the moment to catch uninitialised-variable bugs
+constexpr v2::v2() : x(NAN), y(NAN) {}
+
+constexpr v2::v2(double x_, double y_) : x(x_), y(y_) {}
+
+// hypot() is much slower than this, and its extra overflow protection isn't needed for shape coordinates.
 double v2::length() const {
-	return hypot(x, y);
+	return sqrt(x*x + y*y);
 }
 
 double v2::distance(const v2 &rh) const {
-	return hypot(x - rh.x, y - rh.y);
+	return (*this - rh).length();
 }
 
 bool v2::is_0() const {
@@ -63,14 +105,14 @@ v2 v2::right_normal_or_0() const {
 }
 
 v2 v2::normal_in_direction_or_0(v2 direction) const {
-	v2 normal_a = right_normal_or_0(); // TODO: I don't think this needs to be normalised until we return.
-	double dot_result = dot(normal_a, direction);
+	v2 perpendicular_a = v2(y, -x);
+	double dot_result = dot(perpendicular_a, direction);
 	
 	if (dot_result > 0) {
-		return normal_a;
+		return perpendicular_a.normalised_or_0();
 	} else if (dot_result < 0) {
-		v2 normal_b = normal_a * -1;
-		return normal_b;
+		v2 perpendicular_b = perpendicular_a * -1;
+		return perpendicular_b.normalised_or_0();
 	} else {
 		return v2(0, 0);
 	}
@@ -79,8 +121,25 @@ v2 v2::normal_in_direction_or_0(v2 direction) const {
 v2 v2::rotated(double radians) const {
 	v2 oldv = *this;
 	radians *= -1; // flip the sign so that a positive number rotates the vector clockwise
-	return v2(oldv.x*cos(radians) - oldv.y*sin(radians),
-		oldv.x*sin(radians) + oldv.y*cos(radians));
+	#ifdef RW_GJK_DETERMINISTIC
+		double radians_sin, radians_cos;
+		bundled_sin_cos(radians, &radians_sin, &radians_cos);
+	#else
+		double radians_sin = sin(radians);
+		double radians_cos = cos(radians);
+	#endif
+	return v2(oldv.x*radians_cos - oldv.y*radians_sin,
+		oldv.x*radians_sin + oldv.y*radians_cos);
+}
+
+// The same as rotated(radians), but with the trig already done.
+v2 v2::rotated(double radians_cos, double radians_sin) const {
+	return v2(x*radians_cos + y*radians_sin, -x*radians_sin + y*radians_cos);
+}
+
+// Undoes rotated(radians_cos, radians_sin).
+v2 v2::unrotated(double radians_cos, double radians_sin) const {
+	return v2(x*radians_cos - y*radians_sin, x*radians_sin + y*radians_cos);
 }
 
 bool v2::operator==(const v2 &rh) const {
@@ -91,22 +150,22 @@ bool v2::operator!=(const v2 &rh) const {
 	return !(*this == rh);
 }
 
-v2 v2::operator+(const v2 &rh) const {
+constexpr v2 v2::operator+(const v2 &rh) const {
 	return v2(x + rh.x, y + rh.y);
 }
 
-v2 v2::operator-(const v2 &rh) const {
+constexpr v2 v2::operator-(const v2 &rh) const {
 	return v2(x - rh.x, y - rh.y);
 }
 
-v2 v2::operator-() const {
+constexpr v2 v2::operator-() const {
 	return v2(-x, -y);
 }
 
-v2 v2::operator*(const double &rh) const {
+constexpr v2 v2::operator*(const double &rh) const {
 	return v2(x * rh, y * rh);
 }
 
-v2 v2::operator/(const double &rh) const {
+constexpr v2 v2::operator/(const double &rh) const {
 	return v2(x / rh, y / rh);
 }
\ No newline at end of file